@@ -0,0 +1,121 @@
+/*
+  Allocation policies for the containers in this library.
+  Copyright (C) 2018 Sio Kreuzer
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// An allocator policy is a type providing:
+//   static void* alloc( size_t bytes, size_t alignment ) -> aligned to (at least) alignment, which is a power of two. nullptr on failure. Contents are unspecified.
+//   static void dealloc( void* x, size_t bytes ) -> bytes is the same as given to alloc, but only if sized_dealloc is set (0 otherwise)
+//   static const bool sized_dealloc -> whether dealloc needs to know the size (containers that would have to compute it, e.g. strings, skip that if not)
+// Policies have no state of their own, so containers stay as small as they are. To allocate from an arena/pool/NUMA node, have the policy forward to a global or thread_local one.
+// Maps pass alignment 64 for their tables (HashMap keeps the length in the low 6 bits of the table pointer), strings alignof( C ).
+// Allocators:
+// -> DefaultAllocator: malloc/free, aligned_alloc for alignments above alignof( std::max_align_t ) (what the containers used before allocators were pluggable)
+// -> HugePageAllocator: for large tables with random access, where TLB misses make up a good part of a lookup. Tables of at least huge_page_threshold bytes get 2MB aligned anonymous mappings backed by huge pages:
+//    -> transparent huge pages (madvise( MADV_HUGEPAGE )) if enabled,
+//    -> otherwise explicitly reserved huge pages (MAP_HUGETLB) if there are any,
+//    -> otherwise regular pages (still 2MB aligned, so khugepaged may collapse them later).
+//    Smaller allocations (and everything on non-linux systems) go through DefaultAllocator, as a huge page would mostly go to waste.
+#pragma once
+
+#include <cstdlib>
+#include <cstddef>
+
+#if defined( __linux__ )
+#include <sys/mman.h>
+#endif
+
+#include "utils.hpp"
+
+namespace LibSio
+{
+
+struct DefaultAllocator
+{
+    static const bool sized_dealloc = false;
+
+    static void* alloc( const size_t bytes, const size_t alignment )
+    {
+        if ( alignment <= alignof( std::max_align_t ) ) {
+            return malloc( bytes );
+        }
+        return aligned_alloc( alignment, ( bytes + alignment - 1 ) & ~( alignment - 1 ) ); // aligned_alloc wants a multiple of the alignment
+    }
+
+    static void dealloc( void* const x, __attribute__((unused)) const size_t bytes )
+    {
+        free( x );
+    }
+};
+
+struct HugePageAllocator
+{
+    static const size_t huge_page_size = 2 * 1024 * 1024;
+    static const size_t huge_page_threshold = huge_page_size;
+    static const bool sized_dealloc = true;
+
+    static inline size_t mapping_size( const size_t bytes )
+    {
+        return ( bytes + huge_page_size - 1 ) & ~( huge_page_size - 1 );
+    }
+
+    static void* alloc( const size_t bytes, const size_t alignment )
+    {
+#if defined( __linux__ )
+        if ( bytes >= huge_page_threshold ) {
+            const size_t size = mapping_size( bytes );
+            // over-allocate by a huge page, then cut off whatever is in front of/behind the 2MB aligned part
+            byte* const x = ( byte* ) mmap( nullptr, size + huge_page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+            if ( x == MAP_FAILED ) {
+                return nullptr;
+            }
+            byte* const aligned = ( byte* ) ( ( ( size_t ) x + huge_page_size - 1 ) & ~( huge_page_size - 1 ) );
+            if ( aligned != x ) {
+                munmap( x, aligned - x );
+            }
+            if ( aligned + size != x + size + huge_page_size ) {
+                munmap( aligned + size, ( x + size + huge_page_size ) - ( aligned + size ) );
+            }
+#if defined( MADV_HUGEPAGE )
+            if ( madvise( aligned, size, MADV_HUGEPAGE ) == 0 ) {
+                return aligned;
+            }
+#endif
+#if defined( MAP_HUGETLB )
+            void* const tlb = mmap( nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+            if ( tlb != MAP_FAILED ) {
+                munmap( aligned, size );
+                return tlb;
+            }
+#endif
+            return aligned;
+        }
+#endif
+        return DefaultAllocator::alloc( bytes, alignment );
+    }
+
+    static void dealloc( void* const x, const size_t bytes )
+    {
+#if defined( __linux__ )
+        if ( bytes >= huge_page_threshold ) {
+            munmap( x, mapping_size( bytes ) );
+            return;
+        }
+#endif
+        DefaultAllocator::dealloc( x, bytes );
+    }
+};
+
+}
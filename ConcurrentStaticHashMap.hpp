@@ -0,0 +1,286 @@
+/*
+  Statically sized hashmap that any number of threads may insert into at the same time.
+  Copyright (C) 2018 Sio Kreuzer
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Insert-only variant of StaticHashMap (same linear probing, same Index policies) for building a table from many threads at once.
+// Every slot has a state byte:
+// -> slot_empty: nothing in there
+// -> slot_busy: a thread has claimed the slot (CAS from slot_empty) and is constructing the key and value in it
+// -> slot_full | tag: key and value are there, tag is a 7 bit fragment of the mixed hash of the key (eq() is only called on tag matches)
+// Inserting threads never block each other, except when running into a slot that is being filled: the key in it might be the same one, so they wait for it to become full.
+// Lookups are wait-free: they skip busy slots (an insert that has not finished yet has not happened yet, as far as lookups are concerned) and stop at the first empty slot.
+// There is no rm. Once the table is built, freeze() moves it into a plain StaticHashMap without rehashing anything.
+#pragma once
+
+#include <atomic>
+#include <cstdlib>
+#include <cassert>
+
+#include "StaticHashMap.hpp"
+
+#include "utils.hpp"
+
+namespace LibSio
+{
+
+template< typename K
+        , typename V
+        , size_t ( *_hash )( const K* const x ) = standard_hash< K >
+        , bool ( *eq )( const K* const a, const K* const b ) = standard_eq< K >
+        , typename Index = ModuloIndex<>
+        , typename Alloc = DefaultAllocator
+        >
+struct ConcurrentStaticHashMap
+{
+    typedef ConcurrentStaticHashMap< K, V, _hash, eq, Index, Alloc > own_type;
+    typedef StaticHashMap< K, V, _hash, eq, Index, Alloc > static_type;
+
+    constexpr static const size_t no_index = __SIZE_MAX__;
+
+    static const u8 slot_empty = 0;
+    static const u8 slot_busy = 1;
+    static const u8 slot_full = 0b10000000;
+
+    // layout: keys, values, states
+    byte* kvs;
+    size_t length;
+
+    K* keys()
+    {
+        return ( K* ) kvs;
+    }
+
+    V* values()
+    {
+        return ( V* ) ( kvs + key_arr_len_in_bytes< K, V >( length ) );
+    }
+
+    std::atomic< u8 >* states()
+    {
+        return ( std::atomic< u8 >* ) ( kvs + overall_arr_len_in_bytes< K, V >( length ) );
+    }
+
+    size_t arr_len_in_bytes()
+    {
+        return overall_arr_len_in_bytes< K, V >( length ) + length * sizeof( std::atomic< u8 > );
+    }
+
+    static inline u8 full_state( const size_t mixed )
+    {
+        return slot_full | ( u8 ) ( ( mixed ^ ( mixed >> 57 ) ) & 0b01111111 );
+    }
+
+    ConcurrentStaticHashMap() = delete;
+
+    ConcurrentStaticHashMap( const own_type& ) = delete;
+
+    ConcurrentStaticHashMap( size_t a_length )
+        : kvs( nullptr )
+        , length( a_length )
+    {
+        assert( length );
+        assert( !Index::needs_power_of_two_length || ( length & ( length - 1 ) ) == 0 );
+        kvs = ( byte* ) Alloc::alloc( arr_len_in_bytes(), 64 );
+        assert( kvs );
+        for ( size_t i = 0; i < length; i++ ) {
+            new( states() + i ) std::atomic< u8 >( slot_empty );
+        }
+    }
+
+    // not thread safe, every inserting thread must be done
+    ~ConcurrentStaticHashMap()
+    {
+        if ( kvs ) {
+            for ( size_t i = 0; i < length; i++ ) {
+                if ( states()[i].load( std::memory_order_relaxed ) & slot_full ) {
+                    callDestructorIfExistent< K >( keys() + i );
+                    callDestructorIfExistent< V >( values() + i );
+                }
+            }
+            Alloc::dealloc( kvs, arr_len_in_bytes() );
+        }
+    }
+
+    // index of k, no_index if not (yet) in the map. Wait-free.
+    size_t get_index_for_key( const K* const k )
+    {
+        const size_t mixed = Index::mix( _hash( k ) );
+        const size_t hashed = Index::index( mixed, length );
+        const u8 full = full_state( mixed );
+        for ( size_t i = 0; i < length; i++ ) {
+            const size_t index = hashed + i < length ? hashed + i : hashed + i - length;
+            const u8 state = states()[index].load( std::memory_order_acquire );
+            if ( state == slot_empty ) {
+                return no_index;
+            } else if ( state == full && eq( keys() + index, k ) ) {
+                return index;
+            }
+        }
+        return no_index;
+    }
+
+    // pointers stay valid for as long as the map exists (nothing is ever moved or removed)
+    V* get_ref( const K& k )
+    {
+        auto index = get_index_for_key( &k );
+        if ( index != no_index ) {
+            return values() + index;
+        } else {
+            return nullptr;
+        }
+    }
+
+    Optional< V > get( const K& k )
+    {
+        auto el = get_ref( k );
+        if ( el ) {
+            return Just< V >( *el );
+        } else {
+            return Nothing< V >();
+        }
+    }
+
+    bool insert( const K& k, const V& v )
+    {
+        return emplace( k, v );
+    }
+
+    // may fail if there is no space left in the hashmap
+    // will simply do nothing and return true if key already in map (or being inserted by another thread at the same time, in which case one of them wins)
+    // returns false on failure
+    template< typename... Args >
+    bool emplace( const K& k, Args... args )
+    {
+        const size_t mixed = Index::mix( _hash( &k ) );
+        const size_t hashed = Index::index( mixed, length );
+        const u8 full = full_state( mixed );
+        for ( size_t i = 0; i < length; i++ ) {
+            const size_t index = hashed + i < length ? hashed + i : hashed + i - length;
+            std::atomic< u8 >& s = states()[index];
+            u8 state = s.load( std::memory_order_acquire );
+            if ( state == slot_empty ) {
+                if ( s.compare_exchange_strong( state, slot_busy, std::memory_order_acquire ) ) {
+                    new( keys() + index ) K( k );
+                    new( values() + index ) V( args... );
+                    s.store( full, std::memory_order_release );
+                    return true;
+                }
+                // lost the slot to another thread, state is what it claimed it with
+            }
+            while ( state == slot_busy ) {
+#if defined( __x86_64__ ) || defined( __i386__ )
+                __builtin_ia32_pause();
+#endif
+                state = s.load( std::memory_order_acquire );
+            }
+            if ( state == full && eq( keys() + index, &k ) ) {
+                return true; // key already in map
+            }
+        }
+        return false; // no space left
+    }
+
+    // not thread safe
+    size_t count()
+    {
+        size_t n = 0;
+        for ( size_t i = 0; i < length; i++ ) {
+            if ( states()[i].load( std::memory_order_relaxed ) & slot_full ) {
+                n++;
+            }
+        }
+        return n;
+    }
+
+    // not thread safe, see foreach_cell
+    void foreach_value( void ( *fn )( V* value ) )
+    {
+        foreach_cell(
+            [&]
+            ( __attribute__((unused)) const K* _, V* v )
+            -> void
+            {
+                fn( v );
+            }
+        );
+    }
+
+    template< typename F >
+    void foreach_value_lambda( F fn )
+    {
+        foreach_cell(
+            [&]
+            ( __attribute__((unused)) const K* _, V* v )
+            -> void
+            {
+                fn( v );
+            }
+        );
+    }
+
+    void foreach( void ( *fn )( const K* key, V* value ) )
+    {
+        foreach_cell( fn );
+    }
+
+    template< typename F >
+    void foreach_lambda( F fn )
+    {
+        foreach_cell( fn );
+    }
+
+    // foreach/foreach_value for any callable (lambdas with captures, function objects), which unlike std::function can be inlined
+    template< typename F >
+    void foreach( F fn )
+    {
+        foreach_lambda( fn );
+    }
+
+    template< typename F >
+    void foreach_value( F fn )
+    {
+        foreach_value_lambda( fn );
+    }
+
+    // calls fn( key, value ) for every element that has been fully inserted
+    template< typename F >
+    void foreach_cell( F fn )
+    {
+        for ( size_t i = 0; i < length; i++ ) {
+            if ( states()[i].load( std::memory_order_acquire ) & slot_full ) {
+                fn( keys() + i, values() + i );
+            }
+        }
+    }
+
+    // moves everything into a StaticHashMap of the same length, slot for slot (the probe sequences are the same, so nothing needs to be rehashed)
+    // not thread safe, every inserting thread must be done. This map is left empty.
+    static_type freeze( K empty_key )
+    {
+        static_type x( length, empty_key );
+        for ( size_t i = 0; i < length; i++ ) {
+            if ( states()[i].load( std::memory_order_relaxed ) & slot_full ) {
+                callDestructorIfExistent< K >( x.key( i ) );
+                relocate< K >( x.key( i ), keys() + i );
+                relocate< V >( x.value( i ), values() + i );
+                states()[i].store( slot_empty, std::memory_order_relaxed );
+            }
+        }
+        return x;
+    }
+};
+
+}
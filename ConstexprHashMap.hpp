@@ -0,0 +1,254 @@
+/*
+  Statically sized hashmap laid out at compile time.
+  Copyright (C) 2018 Sio Kreuzer
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// StaticHashMap for tables of literals (enums, integers, string literals) that never change:
+//     constexpr std::pair< const char*, int > table[] = { { "a", 1 }, { "b", 2 } };
+//     constexpr ConstexprHashMap< const char*, int, 4 > map( table, nullptr );
+// -> a constexpr map is built by the compiler and ends up in read-only data (.rodata, .data.rel.ro for pointers in position independent code): no code runs at startup
+// -> lookups are constexpr as well, lookups of literal keys in a constexpr map fold to constants: static_assert( map.get_or( "b", 0 ) == 2 )
+// -> same layout (keys(), values(), empty key marking free slots) and the same linear probing as StaticHashMap, but as arrays inside the object, sized by the template parameter length
+// -> no insert/rm, so lookups stop at the first free slot
+// The hash and eq functions have to be constexpr: std::hash is not, so the default is constexpr_hash (integers, enums, const char* and std::string_view), mixed by the Index policy as usual.
+// Building fails to compile if there are more entries than slots or one of them is the empty key. Of equal keys, the first one wins (as with StaticHashMap::insert).
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstddef>
+#include <utility>
+#include <string_view>
+#include <type_traits>
+
+#include "IndexPolicy.hpp"
+
+#include "utils.hpp"
+
+namespace LibSio
+{
+
+namespace detail
+{
+
+// FNV-1a
+constexpr size_t constexpr_hash_chars( const char* const x, const size_t length )
+{
+    size_t h = 14695981039346656037LU;
+    for ( size_t i = 0; i < length; i++ ) {
+        h ^= ( unsigned char ) x[i];
+        h *= 1099511628211LU;
+    }
+    return h;
+}
+
+constexpr size_t constexpr_strlen( const char* const x )
+{
+    size_t n = 0;
+    for ( ; x[n] != '\0'; n++ );
+    return n;
+}
+
+template< typename T >
+struct dependent_false
+    : std::false_type
+{};
+
+// not constexpr: reaching a call during constant evaluation fails to compile (with or without NDEBUG), at runtime it aborts
+inline void constexpr_fail( const char* const why )
+{
+    fprintf( stderr, "%s\n", why );
+    abort();
+}
+
+}
+
+template< typename T >
+constexpr size_t constexpr_hash( const T* const x )
+{
+    if constexpr ( std::is_integral< T >::value || std::is_enum< T >::value ) {
+        return ( size_t ) *x;
+    } else if constexpr ( std::is_same< T, const char* >::value ) {
+        return *x ? detail::constexpr_hash_chars( *x, detail::constexpr_strlen( *x ) ) : 0;
+    } else if constexpr ( std::is_same< T, std::string_view >::value ) {
+        return detail::constexpr_hash_chars( x -> data(), x -> size() );
+    } else {
+        static_assert( detail::dependent_false< T >::value, "constexpr_hash: no constexpr hash for this type, supply one" );
+        return 0;
+    }
+}
+
+// compares the strings for const char* (a null pointer only equals a null pointer, so it may be used as the empty key)
+template< typename T >
+constexpr bool constexpr_eq( const T* const a, const T* const b )
+{
+    if constexpr ( std::is_same< T, const char* >::value ) {
+        if ( !*a || !*b ) {
+            return *a == *b;
+        }
+        size_t i = 0;
+        for ( ; ( *a )[i] != '\0' && ( *a )[i] == ( *b )[i]; i++ );
+        return ( *a )[i] == ( *b )[i];
+    } else {
+        return ( *a ) == ( *b );
+    }
+}
+
+template< typename K
+        , typename V
+        , size_t length
+        , size_t ( *_hash )( const K* const x ) = constexpr_hash< K >
+        , bool ( *eq )( const K* const a, const K* const b ) = constexpr_eq< K >
+        , typename Index = ModuloIndex<>
+        >
+struct ConstexprHashMap
+{
+    typedef ConstexprHashMap< K, V, length, _hash, eq, Index > own_type;
+
+    static_assert( length > 0, "ConstexprHashMap: length must be at least 1" );
+    static_assert( !Index::needs_power_of_two_length || ( length & ( length - 1 ) ) == 0, "ConstexprHashMap: Index policy needs a power of two length" );
+
+    constexpr static const size_t no_index = __SIZE_MAX__;
+
+    K _keys[length];
+    V _values[length];
+    K empty_key;
+
+    static constexpr size_t hash( const K* const x )
+    {
+        return Index::index( Index::mix( _hash( x ) ), length );
+    }
+
+    ConstexprHashMap() = delete;
+
+    template< size_t n >
+    constexpr ConstexprHashMap( const std::pair< K, V > ( &entries )[n], const K an_empty_key )
+        : _keys {}
+        , _values {}
+        , empty_key( an_empty_key )
+    {
+        static_assert( n <= length, "ConstexprHashMap: more entries than slots" );
+        for ( size_t i = 0; i < length; i++ ) {
+            _keys[i] = empty_key;
+        }
+        for ( size_t e = 0; e < n; e++ ) {
+            const K& k = entries[e].first;
+            if ( eq( &k, &empty_key ) ) {
+                detail::constexpr_fail( "ConstexprHashMap: empty key inserted" );
+            }
+            const size_t hashed = hash( &k );
+            for ( size_t i = 0; i < length; i++ ) {
+                const size_t index = hashed + i < length ? hashed + i : hashed + i - length;
+                if ( eq( _keys + index, &empty_key ) ) {
+                    _keys[index] = k;
+                    _values[index] = entries[e].second;
+                    break;
+                } else if ( eq( _keys + index, &k ) ) {
+                    break; // key already in map
+                }
+            }
+        }
+    }
+
+    constexpr const K* keys() const
+    {
+        return _keys;
+    }
+
+    constexpr const V* values() const
+    {
+        return _values;
+    }
+
+    // index of k, no_index if k is not in the map
+    constexpr size_t get_index_for_key( const K* const k ) const
+    {
+        const size_t hashed = hash( k );
+        for ( size_t i = 0; i < length; i++ ) {
+            const size_t index = hashed + i < length ? hashed + i : hashed + i - length;
+            if ( eq( _keys + index, &empty_key ) ) {
+                return no_index;
+            } else if ( eq( _keys + index, k ) ) {
+                return index;
+            }
+        }
+        return no_index;
+    }
+
+    constexpr const V* get_ref( const K& k ) const
+    {
+        const size_t index = get_index_for_key( &k );
+        return index != no_index ? _values + index : nullptr;
+    }
+
+    constexpr bool contains( const K& k ) const
+    {
+        return get_index_for_key( &k ) != no_index;
+    }
+
+    // the value of k, or otherwise if k is not in the map (Optional is not a literal type)
+    constexpr V get_or( const K& k, const V otherwise ) const
+    {
+        const size_t index = get_index_for_key( &k );
+        return index != no_index ? _values[index] : otherwise;
+    }
+
+    template< typename F >
+    void foreach_lambda( F fn ) const
+    {
+        for ( size_t i = 0; i < length; i++ ) {
+            if ( !eq( _keys + i, &empty_key ) ) {
+                fn( _keys + i, _values + i );
+            }
+        }
+    }
+
+    template< typename F >
+    void foreach_value_lambda( F fn ) const
+    {
+        for ( size_t i = 0; i < length; i++ ) {
+            if ( !eq( _keys + i, &empty_key ) ) {
+                fn( _values + i );
+            }
+        }
+    }
+
+    // foreach/foreach_value for any callable (lambdas with captures, function objects), which unlike std::function can be inlined
+    template< typename F >
+    void foreach( F fn ) const
+    {
+        foreach_lambda( fn );
+    }
+
+    template< typename F >
+    void foreach_value( F fn ) const
+    {
+        foreach_value_lambda( fn );
+    }
+
+    // count of elements in container
+    constexpr size_t count() const
+    {
+        size_t n = 0;
+        for ( size_t i = 0; i < length; i++ ) {
+            if ( !eq( _keys + i, &empty_key ) ) {
+                n++;
+            }
+        }
+        return n;
+    }
+};
+
+}
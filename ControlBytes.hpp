@@ -0,0 +1,133 @@
+/*
+  Per-slot control byte metadata for open addressing hashmaps.
+  Copyright (C) 2018 Sio Kreuzer
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// one byte per slot:
+// -> 0b1xxxxxxx: slot is empty (ctrl_empty)
+// -> 0b0xxxxxxx: slot is full, low 7 bits are a fragment of the (mixed) hash of the key in it
+// -> ctrl_dead (0b11111111) is a special empty value: the slot holds no object at all, as it's contents have been relocated elsewhere
+// -> ctrl_deleted (0b11111110) is another one: a tombstone, for maps whose probes stop at empty slots but can not move keys back on removal (SwissHashMap)
+// groups of control bytes are compared against a fragment in one go, so eq() only has to be called on fragment hits.
+// uses AVX2 (32 bytes at a time) or SSE2 (16 bytes at a time) where available, falls back to a plain loop otherwise.
+#pragma once
+
+#include <cstring>
+
+#if defined( __AVX2__ ) || defined( __SSE2__ )
+#include <immintrin.h>
+#endif
+
+#include "utils.hpp"
+
+namespace LibSio
+{
+
+namespace detail
+{
+
+static const u8 ctrl_empty = 0b10000000;
+static const u8 ctrl_dead = 0b11111111;
+static const u8 ctrl_deleted = 0b11111110;
+
+// 7 bit fragment of a hash. Folds the top bits onto the bottom bits, as the index into the table is taken from one end of the hash (which is then more or less the same for every key within a probe window) and the fragment should not be.
+constexpr u8 ctrl_tag( const size_t hash )
+{
+    return ( u8 ) ( ( hash ^ ( hash >> 57 ) ) & 0b01111111 );
+}
+
+constexpr bool ctrl_is_full( const u8 c )
+{
+    return !( c & ctrl_empty );
+}
+
+#if defined( __AVX2__ )
+static const size_t ctrl_group_width = 32;
+#else
+static const size_t ctrl_group_width = 16;
+#endif
+
+// a group of ctrl_group_width control bytes, unaligned load. Bit n of a mask corresponds to byte n of the group.
+struct CtrlGroup
+{
+#if defined( __AVX2__ )
+    __m256i ctrl;
+
+    CtrlGroup( const u8* const x )
+        : ctrl( _mm256_loadu_si256( ( const __m256i* ) x ) )
+    {}
+
+    u32 match( const u8 tag ) const
+    {
+        return ( u32 ) _mm256_movemask_epi8( _mm256_cmpeq_epi8( ctrl, _mm256_set1_epi8( ( char ) tag ) ) );
+    }
+
+    u32 match_empty() const
+    {
+        return ( u32 ) _mm256_movemask_epi8( ctrl );
+    }
+#elif defined( __SSE2__ )
+    __m128i ctrl;
+
+    CtrlGroup( const u8* const x )
+        : ctrl( _mm_loadu_si128( ( const __m128i* ) x ) )
+    {}
+
+    u32 match( const u8 tag ) const
+    {
+        return ( u32 ) _mm_movemask_epi8( _mm_cmpeq_epi8( ctrl, _mm_set1_epi8( ( char ) tag ) ) );
+    }
+
+    u32 match_empty() const
+    {
+        return ( u32 ) _mm_movemask_epi8( ctrl );
+    }
+#else
+    u8 ctrl[ctrl_group_width];
+
+    CtrlGroup( const u8* const x )
+    {
+        memcpy( ctrl, x, ctrl_group_width );
+    }
+
+    u32 match( const u8 tag ) const
+    {
+        u32 m = 0;
+        for ( size_t i = 0; i < ctrl_group_width; i++ ) {
+            m |= ( ( u32 ) ( ctrl[i] == tag ) ) << i;
+        }
+        return m;
+    }
+
+    u32 match_empty() const
+    {
+        u32 m = 0;
+        for ( size_t i = 0; i < ctrl_group_width; i++ ) {
+            m |= ( ( u32 ) ( ( ctrl[i] & ctrl_empty ) != 0 ) ) << i;
+        }
+        return m;
+    }
+#endif
+};
+
+// mask with all bits below bit n set (n < 32)
+constexpr u32 ctrl_bits_below( const u32 n )
+{
+    return ( ( ( u32 ) 1 ) << n ) - 1;
+}
+
+}
+
+}
@@ -0,0 +1,264 @@
+/*
+  Copy-on-write HashMap snapshots: one writer, any number of lock-free readers.
+  Copyright (C) 2018 Sio Kreuzer
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Copy-on-write snapshots of a HashMap. The writer never modifies the table readers see: it writes to a copy, which publish() then swaps in.
+// -> readers look up in the published snapshot, which is never modified. No locks, no writes to shared cachelines apart from their own epoch slot (see Epoch.hpp).
+// -> the (single) writer modifies a private copy of the published snapshot (made on the first write after a publish()), publish() swaps it in atomically
+//    -> writes are not visible to readers until publish() is called, so batch them: every publish() costs a copy of the table (one memcpy for trivially copyable K and V)
+// -> replaced snapshots are freed once no reader can still be looking at them (checked on every publish(), or forcibly with synchronize())
+// Only suits maps that are read from many threads and written to rarely, in batches (see README): the first write after a publish() copies the whole table, so a batch costs O(n) however few elements it touches.
+// There is no in-place writer: a write is never seen by readers before publish(). For maps that see frequent small writes that readers need to see right away, use ShardedHashMap instead (locks one shard per operation, writes cost O(1)).
+//
+// Usage:
+//   writer thread: map.insert( k, v ); map.rm( k2 ); map.publish();
+//   reader threads: auto r = map.reader(); r.get( k ); (or r.enter(); V* x = r.get_ref( k ); ... r.leave();)
+// Only the writer thread may call anything on the map itself (apart from reader()), only the owning thread may use a Reader.
+#pragma once
+
+#include <cstdlib>
+#include <cassert>
+#include <atomic>
+#include <vector>
+
+#include "HashMap.hpp"
+#include "Epoch.hpp"
+
+#include "utils.hpp"
+
+namespace LibSio
+{
+
+template< typename K, typename V
+        , size_t ( *_hash )( const K* const x ) = standard_hash< K >
+        , bool ( *eq )( const K* const a, const K* const b ) = standard_eq< K >
+        , typename Index = MaskIndex<>
+        , bool store_hash = false
+        , size_t max_readers = 64
+        , typename Alloc = DefaultAllocator > // used for the snapshots' tables and the snapshots themselves
+struct CopyOnWriteHashMap
+{
+    typedef CopyOnWriteHashMap< K, V, _hash, eq, Index, store_hash, max_readers, Alloc > own_type;
+    // no incremental resizing: lookups would migrate slots, i.e. write to the snapshot
+    typedef HashMap< K, V, _hash, eq, Index, false, store_hash, false, Alloc > map_type;
+    typedef EpochDomain< max_readers > domain_type;
+
+    struct retired_map
+    {
+        map_type* map;
+        u64 epoch;
+    };
+
+    std::atomic< map_type* > published;
+    map_type* pending; // writer's copy of published with all writes since the last publish(), null if there are none
+    std::vector< retired_map > retired; // replaced snapshots readers may still be looking at
+    domain_type epochs;
+
+    static map_type* new_map( K empty_key )
+    {
+        map_type* x = ( map_type* ) Alloc::alloc( sizeof( map_type ), alignof( map_type ) );
+        assert( x );
+        new( x ) map_type( empty_key );
+        return x;
+    }
+
+    static map_type* copy_map( map_type* y )
+    {
+        map_type* x = ( map_type* ) Alloc::alloc( sizeof( map_type ), alignof( map_type ) );
+        assert( x );
+        new( x ) map_type( *y );
+        return x;
+    }
+
+    static void delete_map( map_type* x )
+    {
+        x -> ~map_type();
+        Alloc::dealloc( x, sizeof( map_type ) );
+    }
+
+    // a reader thread's handle on the map, holds one of the max_readers epoch slots while it exists
+    struct Reader
+    {
+        own_type* map;
+        size_t slot;
+        map_type* snapshot; // only valid between enter() and leave()
+
+        Reader( own_type* x )
+            : map( x )
+            , slot( x -> epochs.register_reader() )
+            , snapshot( nullptr )
+        {
+            assert( slot != domain_type::no_reader ); // more than max_readers readers at once
+        }
+
+        Reader( const Reader& ) = delete;
+
+        ~Reader()
+        {
+            map -> epochs.unregister_reader( slot );
+        }
+
+        // pins the current snapshot, pointers obtained from get_ref stay valid until leave()
+        void enter()
+        {
+            map -> epochs.enter( slot );
+            snapshot = map -> published.load();
+        }
+
+        void leave()
+        {
+            snapshot = nullptr;
+            map -> epochs.leave( slot );
+        }
+
+        // only between enter() and leave(). Q may be K or anything the map may be searched by (see HashMap::get_ref( const Q& ))
+        template< typename Q >
+        V* get_ref( const Q& q )
+        {
+            assert( snapshot );
+            return snapshot -> get_ref( q );
+        }
+
+        // only between enter() and leave()
+        void get_many( const K* const ks, const size_t n, V** const out )
+        {
+            assert( snapshot );
+            snapshot -> get_many( ks, n, out );
+        }
+
+        // enters and leaves by itself, as the value is copied out
+        template< typename Q >
+        Optional< V > get( const Q& q )
+        {
+            enter();
+            Optional< V > x = snapshot -> get( q );
+            leave();
+            return x;
+        }
+    };
+
+    CopyOnWriteHashMap() = delete;
+
+    CopyOnWriteHashMap( K empty_key )
+        : published( new_map( empty_key ) )
+        , pending( nullptr )
+        , retired()
+        , epochs()
+    {}
+
+    CopyOnWriteHashMap( const own_type& ) = delete;
+
+    // there must not be any readers left
+    ~CopyOnWriteHashMap()
+    {
+        if ( pending ) {
+            delete_map( pending );
+        }
+        delete_map( published.load() );
+        for ( retired_map& x : retired ) {
+            delete_map( x.map );
+        }
+    }
+
+    Reader reader()
+    {
+        return Reader( this );
+    }
+
+    // the writer's copy of the published snapshot, which all writes go to: copies the whole table on the first write after a publish()
+    map_type* writable_copy()
+    {
+        if ( !pending ) {
+            pending = copy_map( published.load() );
+        }
+        return pending;
+    }
+
+    // makes all writes since the last publish() visible to readers
+    void publish()
+    {
+        if ( !pending ) {
+            return;
+        }
+        map_type* old = published.exchange( pending );
+        pending = nullptr;
+        retired.push_back( retired_map { old, epochs.retire() } );
+        reclaim();
+    }
+
+    // frees every replaced snapshot no reader can see anymore
+    void reclaim()
+    {
+        size_t kept = 0;
+        for ( size_t i = 0; i < retired.size(); i++ ) {
+            if ( epochs.safe( retired[i].epoch ) ) {
+                delete_map( retired[i].map );
+            } else {
+                retired[kept++] = retired[i];
+            }
+        }
+        retired.resize( kept );
+    }
+
+    // waits for all readers to leave the snapshots they are in, then frees every replaced snapshot
+    void synchronize()
+    {
+        epochs.synchronize();
+        reclaim();
+    }
+
+    // writer side: sees writes that have not been published yet
+    template< typename Q >
+    V* get_ref( const Q& q )
+    {
+        return ( pending ? pending : published.load() ) -> get_ref( q );
+    }
+
+    template< typename Q >
+    Optional< V > get( const Q& q )
+    {
+        return ( pending ? pending : published.load() ) -> get( q );
+    }
+
+    bool insert( const K& k, V& v )
+    {
+        return writable_copy() -> insert( k, v );
+    }
+
+    template< typename... Args >
+    bool emplace( const K& k, Args... args )
+    {
+        return writable_copy() -> emplace( k, args... );
+    }
+
+    template< typename Q >
+    void rm( const Q& q )
+    {
+        writable_copy() -> rm( q );
+    }
+
+    void reserve( const size_t n )
+    {
+        writable_copy() -> reserve( n );
+    }
+
+    void clear()
+    {
+        writable_copy() -> clear();
+    }
+};
+
+}
@@ -0,0 +1,662 @@
+/*
+  Hashmap using bucketized cuckoo hashing, two cachelines per lookup at high load factors.
+  Copyright (C) 2018 Sio Kreuzer
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Same guarantee as HashMap (a key is found within two cachelines of keys), by different means:
+// -> keys are grouped into buckets of one cacheline (bucket_slots keys each)
+// -> every key may be in one of exactly two buckets: bucket1 (Index::index of it's mixed hash) or bucket2 (Index::index of the mixed hash remixed with Murmur3Mix, never the same as bucket1)
+//    -> a lookup compares the keys in those two buckets (prefetching the second while going through the first) and nothing else
+// -> an insert into two full buckets searches breadth first (visiting at most max_bfs_buckets buckets) for a chain of keys that can each move to their other bucket, ending in a bucket with a free slot, and moves them along
+//    -> this keeps working up to load factors well above 90%, where HashMap would long have run into it's probe limit
+// -> if there is no such chain, the key goes into a small stash (stash_slots keys, searched only if it is not empty) instead, and only when that is full, the table is doubled
+//    -> removing a key from a bucket moves stashed keys belonging to that bucket back into it
+// -> free slots contain the empty key, as in the other maps of this library (no control bytes)
+// CONSTRAINTS:
+// Key:
+//   -> 64 % sizeof( Key ) == 0, so buckets line up with cachelines (currently not enforced by compiler)
+//   -> must be copy constructible
+//   -> is moved (or memcpy'd if is_trivially_relocatable) when keys are displaced or the table is resized
+//   -> must set aside an "empty"/"null" value
+// Value:
+//   -> must be copy constructible
+// Performance characteristics:
+//   -> get/rm: O(1), two buckets (and the stash, if anything is stashed)
+//   -> insert: O(1) average, O(max_bfs_buckets) when displacing keys, O(n) when the table has to be doubled
+#pragma once
+
+#include <cassert>
+#include <cstring>
+#include <utility>
+#include <type_traits>
+
+#include "StaticHashMap.hpp"
+#include "IndexPolicy.hpp"
+#include "Allocator.hpp"
+#include "Optional.hpp"
+
+#include "utils.hpp"
+
+namespace LibSio
+{
+
+template< typename K, typename V
+        , size_t ( *_hash )( const K* const x ) = standard_hash< K >
+        , bool ( *eq )( const K* const a, const K* const b ) = standard_eq< K >
+        , typename Index = MaskIndex<> // bucket counts are powers of two, so any policy works
+        , typename Alloc = DefaultAllocator >
+struct CuckooHashMap
+{
+    typedef CuckooHashMap< K, V, _hash, eq, Index, Alloc > own_type;
+
+    constexpr static const size_t no_index = __SIZE_MAX__;
+    static const size_t bucket_slots = sizeof( K ) >= 64 ? 1 : 64 / sizeof( K );
+    static const size_t stash_slots = 8;
+    static const size_t initial_buckets = 2;
+    static const size_t max_bfs_buckets = 128; // buckets an insert looks through for a displacement chain before stashing the key
+    static const size_t reserve_load_percent = 90; // load factor reserve() sizes the table for
+    static const size_t get_many_batch = 16; // keys hashed and prefetched ahead of resolving them in get_many()
+
+    // layout: keys, values; bucket_count * bucket_slots slots in buckets followed by stash_slots slots of stash
+    byte* kvs;
+    size_t bucket_count;
+    size_t elements;
+    size_t stashed; // the stash is packed, stash slots 0 ... stashed - 1 are full
+    K empty_key;
+
+    static inline size_t slots_for( const size_t buckets )
+    {
+        return buckets * bucket_slots + stash_slots;
+    }
+
+    inline size_t slots()
+    {
+        return slots_for( bucket_count );
+    }
+
+    inline size_t stash_begin()
+    {
+        return bucket_count * bucket_slots;
+    }
+
+    inline K* keys()
+    {
+        return ( K* ) kvs;
+    }
+
+    inline V* values()
+    {
+        return ( V* ) ( kvs + key_arr_len_in_bytes< K, V >( slots() ) );
+    }
+
+    inline bool is_full( const size_t i )
+    {
+        return !eq( keys() + i, &empty_key );
+    }
+
+    static inline size_t hash_full( const K* const k )
+    {
+        return Index::mix( _hash( k ) );
+    }
+
+    inline size_t bucket1( const size_t hashed )
+    {
+        return Index::index( hashed, bucket_count );
+    }
+
+    inline size_t bucket2( const size_t hashed )
+    {
+        const size_t b1 = bucket1( hashed );
+        const size_t b2 = Index::index( Murmur3Mix::mix( hashed ), bucket_count );
+        return b2 != b1 ? b2 : b1 ^ 1;
+    }
+
+    // the bucket other than b the key at slot i may be in
+    inline size_t other_bucket( const size_t i, const size_t b )
+    {
+        const size_t hashed = hash_full( keys() + i );
+        const size_t b1 = bucket1( hashed );
+        return b1 != b ? b1 : bucket2( hashed );
+    }
+
+    inline void alloc_table()
+    {
+        kvs = ( byte* ) Alloc::alloc( overall_arr_len_in_bytes< K, V >( slots() ), 64 );
+        assert( kvs );
+        for ( size_t i = 0; i < slots(); i++ ) {
+            new( keys() + i ) K( empty_key );
+        }
+    }
+
+    inline void destroy_table()
+    {
+        if ( !kvs ) {
+            return;
+        }
+        for ( size_t i = 0; i < slots(); i++ ) {
+            if ( is_full( i ) ) {
+                callDestructorIfExistent< V >( values() + i );
+            }
+            callDestructorIfExistent< K >( keys() + i );
+        }
+        Alloc::dealloc( kvs, overall_arr_len_in_bytes< K, V >( slots() ) );
+        kvs = nullptr;
+    }
+
+    // index of the first slot in bucket b with a key that matches( key ) returns true for
+    template< typename M >
+    inline size_t find_in_bucket( const size_t b, M matches )
+    {
+        for ( size_t i = b * bucket_slots; i < ( b + 1 ) * bucket_slots; i++ ) {
+            if ( matches( keys() + i ) ) {
+                return i;
+            }
+        }
+        return no_index;
+    }
+
+    template< typename M >
+    size_t find( const size_t hashed, M matches )
+    {
+        const size_t b2 = bucket2( hashed );
+        __builtin_prefetch( keys() + b2 * bucket_slots );
+        size_t i = find_in_bucket( bucket1( hashed ), matches );
+        if ( i != no_index ) {
+            return i;
+        }
+        i = find_in_bucket( b2, matches );
+        if ( i != no_index ) {
+            return i;
+        }
+        for ( size_t s = stash_begin(); s < stash_begin() + stashed; s++ ) {
+            if ( matches( keys() + s ) ) {
+                return s;
+            }
+        }
+        return no_index;
+    }
+
+    inline size_t free_slot_in_bucket( const size_t b )
+    {
+        for ( size_t i = b * bucket_slots; i < ( b + 1 ) * bucket_slots; i++ ) {
+            if ( !is_full( i ) ) {
+                return i;
+            }
+        }
+        return no_index;
+    }
+
+    // moves the key/value at src into the slot dst, which has no key (not even the empty key) in it. Leaves no key at src.
+    inline void move_slot( const size_t dst, const size_t src )
+    {
+        relocate< K >( keys() + dst, keys() + src );
+        relocate< V >( values() + dst, values() + src );
+    }
+
+    // makes room in one of the buckets of a key with mixed hash hashed, by moving other keys to their other buckets if necessary
+    // returns the free slot with the empty key destroyed (ready to construct a key in), no_index if no free slot could be made
+    size_t make_room( const size_t hashed )
+    {
+        struct step
+        {
+            size_t bucket;
+            size_t parent; // step whose bucket's key at slot moves into bucket, no_index for the key's own buckets
+            size_t slot;
+        };
+
+        const size_t b1 = bucket1( hashed );
+        const size_t b2 = bucket2( hashed );
+        size_t f = free_slot_in_bucket( b1 );
+        if ( f == no_index ) {
+            f = free_slot_in_bucket( b2 );
+        }
+        if ( f != no_index ) {
+            callDestructorIfExistent< K >( keys() + f );
+            return f;
+        }
+
+        step steps[max_bfs_buckets];
+        steps[0] = { b1, no_index, 0 };
+        steps[1] = { b2, no_index, 0 };
+        size_t tail = 2;
+        for ( size_t head = 0; head < tail; head++ ) {
+            const size_t b = steps[head].bucket;
+            for ( size_t s = 0; s < bucket_slots; s++ ) {
+                const size_t i = b * bucket_slots + s;
+                const size_t alt = other_bucket( i, b );
+                f = free_slot_in_bucket( alt );
+                if ( f != no_index ) {
+                    // move everything along the chain, starting at the end
+                    callDestructorIfExistent< K >( keys() + f );
+                    move_slot( f, i );
+                    size_t hole = i;
+                    for ( size_t n = head; steps[n].parent != no_index; n = steps[n].parent ) {
+                        const size_t src = steps[steps[n].parent].bucket * bucket_slots + steps[n].slot;
+                        move_slot( hole, src );
+                        hole = src;
+                    }
+                    return hole;
+                }
+                if ( tail < max_bfs_buckets ) {
+                    // a bucket may only appear once in a chain, as moving keys out of it would change what the chain is based on
+                    bool in_chain = false;
+                    for ( size_t n = head; n != no_index && !in_chain; n = steps[n].parent ) {
+                        in_chain = steps[n].bucket == alt;
+                    }
+                    if ( !in_chain ) {
+                        steps[tail++] = { alt, head, s };
+                    }
+                }
+            }
+        }
+        return no_index;
+    }
+
+    // a slot for a new key with mixed hash hashed (without any key in it): in one of it's buckets, in the stash, or (after doubling the table) in the doubled table
+    size_t slot_for_new( const size_t hashed )
+    {
+        while ( true ) {
+            const size_t n = make_room( hashed );
+            if ( n != no_index ) {
+                return n;
+            }
+            if ( stashed < stash_slots ) {
+                const size_t s = stash_begin() + stashed;
+                stashed++;
+                callDestructorIfExistent< K >( keys() + s );
+                return s;
+            }
+            resize_to( bucket_count * 2 );
+        }
+    }
+
+    void resize_to( const size_t buckets )
+    {
+        own_type x( empty_key, buckets, false );
+        for ( size_t i = 0; i < slots(); i++ ) {
+            if ( is_full( i ) ) {
+                const size_t n = x.slot_for_new( hash_full( keys() + i ) );
+                relocate< K >( x.keys() + n, keys() + i );
+                relocate< V >( x.values() + n, values() + i );
+            } else {
+                callDestructorIfExistent< K >( keys() + i );
+            }
+        }
+        Alloc::dealloc( kvs, overall_arr_len_in_bytes< K, V >( slots() ) );
+        kvs = x.kvs;
+        bucket_count = x.bucket_count;
+        stashed = x.stashed;
+        x.kvs = nullptr;
+    }
+
+    // empties slot i (which must be full)
+    inline void kill_slot( const size_t i )
+    {
+        callDestructorIfExistent< K >( keys() + i );
+        callDestructorIfExistent< V >( values() + i );
+        new( keys() + i ) K( empty_key );
+    }
+
+    // after slot i of bucket b has been emptied: moves a stashed key that belongs to b into it
+    void unstash_into( const size_t i, const size_t b )
+    {
+        for ( size_t s = stash_begin(); s < stash_begin() + stashed; s++ ) {
+            const size_t hashed = hash_full( keys() + s );
+            if ( bucket1( hashed ) == b || bucket2( hashed ) == b ) {
+                callDestructorIfExistent< K >( keys() + i );
+                move_slot( i, s );
+                close_stash_gap( s );
+                return;
+            }
+        }
+    }
+
+    // stash slot s has no key in it (not even the empty key): moves the last stashed key into it
+    inline void close_stash_gap( const size_t s )
+    {
+        const size_t last = stash_begin() + stashed - 1;
+        if ( s != last ) {
+            move_slot( s, last );
+        }
+        new( keys() + last ) K( empty_key );
+        stashed--;
+    }
+
+  private:
+    CuckooHashMap( K _empty_key, const size_t buckets, __attribute__((unused)) const bool sized )
+        : kvs( nullptr )
+        , bucket_count( buckets )
+        , elements( 0 )
+        , stashed( 0 )
+        , empty_key( _empty_key )
+    {
+        alloc_table();
+    }
+
+  public:
+    CuckooHashMap() = delete;
+
+    CuckooHashMap( K _empty_key )
+        : CuckooHashMap( _empty_key, initial_buckets, true )
+    {}
+
+    // bulk construction: sized for all count elements up front (if a key appears more than once, the first one wins)
+    CuckooHashMap( K _empty_key, const K* const keys, const V* const values, const size_t count )
+        : CuckooHashMap( _empty_key )
+    {
+        reserve( count );
+        for ( size_t i = 0; i < count; i++ ) {
+            emplace( keys[i], values[i] );
+        }
+    }
+
+    // copies slot for slot, so nothing needs to be rehashed
+    CuckooHashMap( CuckooHashMap& x )
+        : CuckooHashMap( x.empty_key, x.bucket_count, true )
+    {
+        for ( size_t i = 0; i < slots(); i++ ) {
+            if ( x.is_full( i ) ) {
+                callDestructorIfExistent< K >( keys() + i );
+                new( keys() + i ) K( x.keys()[i] );
+                new( values() + i ) V( x.values()[i] );
+            }
+        }
+        elements = x.elements;
+        stashed = x.stashed;
+    }
+
+    ~CuckooHashMap()
+    {
+        destroy_table();
+    }
+
+    CuckooHashMap& operator=( CuckooHashMap& x )
+    {
+        this -> ~CuckooHashMap();
+        new( this ) own_type( x );
+        return *this;
+    }
+
+    // makes sure the table is large enough for n elements in total (assuming a load factor of reserve_load_percent), only ever grows the table
+    void reserve( const size_t n )
+    {
+        size_t buckets = bucket_count;
+        while ( buckets * bucket_slots * reserve_load_percent / 100 < n ) {
+            buckets *= 2;
+        }
+        if ( buckets > bucket_count ) {
+            resize_to( buckets );
+        }
+    }
+
+    // get_ref for a key with mixed hash hashed that matches( key ) is true for
+    template< typename M >
+    V* get_ref_with( const size_t hashed, M matches )
+    {
+        const size_t i = find( hashed, matches );
+        return i != no_index ? values() + i : nullptr;
+    }
+
+    V* get_ref( const K& k )
+    {
+        return get_ref_with(
+            hash_full( &k )
+          , [&]
+            ( const K* const x )
+            -> bool
+            {
+                return eq( x, &k ) && !eq( x, &empty_key );
+            }
+        );
+    }
+
+    Optional< V > get( const K& k )
+    {
+        V* x = get_ref( k );
+        if ( x ) {
+            return Just< V >( *x );
+        } else {
+            return Nothing< V >();
+        }
+    }
+
+    // get_ref for n keys at once: out[i] = get_ref( ks[i] )
+    // hashes a batch of keys and prefetches both of their buckets before resolving any of them, so the cache misses overlap
+    void get_many( const K* const ks, const size_t n, V** const out )
+    {
+        size_t hashed[get_many_batch];
+        for ( size_t b = 0; b < n; b += get_many_batch ) {
+            const size_t batch = n - b < get_many_batch ? n - b : get_many_batch;
+            for ( size_t j = 0; j < batch; j++ ) {
+                hashed[j] = hash_full( ks + b + j );
+                __builtin_prefetch( keys() + bucket1( hashed[j] ) * bucket_slots );
+                __builtin_prefetch( keys() + bucket2( hashed[j] ) * bucket_slots );
+            }
+            for ( size_t j = 0; j < batch; j++ ) {
+                const K* const k = ks + b + j;
+                out[b + j] = get_ref_with(
+                    hashed[j]
+                  , [=]
+                    ( const K* const x )
+                    -> bool
+                    {
+                        return eq( x, k ) && !eq( x, &empty_key );
+                    }
+                );
+            }
+        }
+    }
+
+    // lookup_key< K, Q > for Q's the map may be searched by (see get_ref( const Q& ))
+    template< typename Q >
+    using lookup_for = typename std::enable_if< detail::heterogeneous_lookup< K, typename std::decay< Q >::type, _hash >::value
+                                              , detail::heterogeneous_lookup< K, typename std::decay< Q >::type, _hash >
+                                              >::type;
+
+    // get_ref/get/rm without constructing a K, e.g. by a const char* or std::string_view for String keys (see lookup_key in utils.hpp)
+    template< typename Q, typename L = lookup_for< Q > >
+    V* get_ref( const Q& q )
+    {
+        return get_ref_with(
+            Index::mix( L::hash( q ) )
+          , [&]
+            ( const K* const x )
+            -> bool
+            {
+                return L::eq( x, q ) && !eq( x, &empty_key );
+            }
+        );
+    }
+
+    template< typename Q, typename L = lookup_for< Q > >
+    Optional< V > get( const Q& q )
+    {
+        V* x = get_ref( q );
+        if ( x ) {
+            return Just< V >( *x );
+        } else {
+            return Nothing< V >();
+        }
+    }
+
+    template< typename Q, typename L = lookup_for< Q > >
+    void rm( const Q& q )
+    {
+        rm_with(
+            Index::mix( L::hash( q ) )
+          , [&]
+            ( const K* const x )
+            -> bool
+            {
+                return L::eq( x, q ) && !eq( x, &empty_key );
+            }
+        );
+    }
+
+    bool insert( const K& k, V& v )
+    {
+        return emplace( k, v );
+    }
+
+    // returns true on success, false if key already in map
+    template< typename... Args >
+    bool emplace( const K& k, Args... args )
+    {
+        if ( eq( &empty_key, &k ) ) {
+            return false; // attempting to insert empty key
+        }
+        return emplace_hashed( hash_full( &k ), k, args... );
+    }
+
+    // emplace with the mixed hash of k already computed
+    template< typename... Args >
+    bool emplace_hashed( const size_t hashed, const K& k, Args... args )
+    {
+        const size_t found = find(
+            hashed
+          , [&]
+            ( const K* const x )
+            -> bool
+            {
+                return eq( x, &k );
+            }
+        );
+        if ( found != no_index ) {
+            return false; // key already in map
+        }
+        const size_t n = slot_for_new( hashed );
+        new( keys() + n ) K( k );
+        new( values() + n ) V( args... );
+        elements++;
+        return true;
+    }
+
+    void rm( const K& k )
+    {
+        rm_with(
+            hash_full( &k )
+          , [&]
+            ( const K* const x )
+            -> bool
+            {
+                return eq( x, &k ) && !eq( x, &empty_key ); // the empty key matches every free slot, it is never in the map
+            }
+        );
+    }
+
+    // rm for a key with mixed hash hashed that matches( key ) is true for
+    template< typename M >
+    void rm_with( const size_t hashed, M matches )
+    {
+        const size_t i = find( hashed, matches );
+        if ( i == no_index ) {
+            return;
+        }
+        elements--;
+        if ( i >= stash_begin() ) {
+            callDestructorIfExistent< K >( keys() + i );
+            callDestructorIfExistent< V >( values() + i );
+            close_stash_gap( i );
+        } else {
+            kill_slot( i );
+            if ( stashed ) {
+                unstash_into( i, i / bucket_slots );
+            }
+        }
+    }
+
+    void clear()
+    {
+        for ( size_t i = 0; i < slots(); i++ ) {
+            if ( is_full( i ) ) {
+                kill_slot( i );
+            }
+        }
+        elements = 0;
+        stashed = 0;
+    }
+
+    // calls fn( key, value ) for every element, in the buckets and the stash
+    template< typename F >
+    inline void foreach_cell( F fn )
+    {
+        for ( size_t i = 0; i < slots(); i++ ) {
+            if ( is_full( i ) ) {
+                fn( ( const K* ) keys() + i, values() + i );
+            }
+        }
+    }
+
+    void foreach_value( void ( *fn )( V* value ) )
+    {
+        foreach_value_lambda( fn );
+    }
+
+    template< typename F >
+    void foreach_value_lambda( F fn )
+    {
+        foreach_cell(
+            [&]
+            ( __attribute__((unused)) const K* _, V* v )
+            -> void
+            {
+                fn( v );
+            }
+        );
+    }
+
+    void foreach( void ( *fn )( const K* key, V* value ) )
+    {
+        foreach_cell( fn );
+    }
+
+    template< typename F >
+    void foreach_lambda( F fn )
+    {
+        foreach_cell( fn );
+    }
+
+    // foreach/foreach_value for any callable (lambdas with captures, function objects), which unlike std::function can be inlined
+    template< typename F >
+    void foreach( F fn )
+    {
+        foreach_lambda( fn );
+    }
+
+    template< typename F >
+    void foreach_value( F fn )
+    {
+        foreach_value_lambda( fn );
+    }
+
+    // count of elements in container, O(1)
+    size_t count()
+    {
+        return elements;
+    }
+
+    bool empty()
+    {
+        return elements == 0;
+    }
+
+    // slots in buckets (the stash is not counted), count() / capacity() is the load factor
+    size_t capacity()
+    {
+        return bucket_count * bucket_slots;
+    }
+};
+
+}
@@ -0,0 +1,110 @@
+/*
+  Epoch based reclamation: freeing memory that lock-free readers may still be looking at.
+  Copyright (C) 2018 Sio Kreuzer
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// A global epoch counter, plus one cacheline sized slot per reader.
+// -> a reader announces the epoch it saw in it's slot before touching shared data (enter()), and clears it afterwards (leave())
+// -> the writer unlinks something, then calls retire(), which advances the global epoch and returns the epoch the thing was retired at
+// -> the thing may be freed once safe( epoch ) is true: every reader is either outside of a critical section or entered one after the thing was unlinked
+// readers never wait on anything; the writer only waits if it calls synchronize().
+// Only one thread may call retire()/safe()/synchronize() at a time, any number of threads may be readers (up to max_readers at once).
+#pragma once
+
+#include <atomic>
+#include <cassert>
+
+#include "utils.hpp"
+
+namespace LibSio
+{
+
+template< size_t max_readers = 64 >
+struct EpochDomain
+{
+    static const size_t no_reader = __SIZE_MAX__;
+    static const u64 inactive = 0; // slot value of a reader outside of a critical section
+
+    // one cacheline per reader, so readers entering/leaving do not contend with each other
+    struct alignas( 64 ) reader_slot
+    {
+        std::atomic< u64 > epoch { inactive };
+        std::atomic< bool > claimed { false };
+    };
+
+    alignas( 64 ) std::atomic< u64 > global_epoch { 1 };
+    reader_slot readers[max_readers];
+
+    // claims a reader slot, returns no_reader if all max_readers slots are taken
+    size_t register_reader()
+    {
+        for ( size_t i = 0; i < max_readers; i++ ) {
+            bool expected = false;
+            if ( readers[i].claimed.compare_exchange_strong( expected, true ) ) {
+                return i;
+            }
+        }
+        return no_reader;
+    }
+
+    void unregister_reader( const size_t r )
+    {
+        assert( readers[r].epoch.load() == inactive );
+        readers[r].claimed.store( false );
+    }
+
+    // everything loaded from shared data after enter() stays valid until leave()
+    void enter( const size_t r )
+    {
+        // seq_cst store: has to be visible to the writer before any shared pointer is loaded
+        readers[r].epoch.store( global_epoch.load() );
+    }
+
+    void leave( const size_t r )
+    {
+        readers[r].epoch.store( inactive, std::memory_order_release );
+    }
+
+    // call after unlinking something; returns the epoch to pass to safe() to find out whether it may be freed
+    u64 retire()
+    {
+        return global_epoch.fetch_add( 1 ) + 1;
+    }
+
+    // whether nothing retired at epoch e can still be seen by any reader
+    bool safe( const u64 e )
+    {
+        for ( size_t i = 0; i < max_readers; i++ ) {
+            const u64 x = readers[i].epoch.load();
+            if ( x != inactive && x < e ) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // waits until everything retired up to now may be freed
+    void synchronize()
+    {
+        const u64 e = retire();
+        while ( !safe( e ) ) {
+#if defined( __x86_64__ ) || defined( __i386__ )
+            __builtin_ia32_pause();
+#endif
+        }
+    }
+};
+
+}
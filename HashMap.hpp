@@ -18,35 +18,51 @@
 // size optimized
 // uses:
 // -> fibonacci secondary hash function (LCG to affect a better distribution in case of a bad primary hash function, multiplies the result of the primary hash function to distribute it within the 2^64 number space)
+//    -> by default, the low bits of that are used as index (MaskIndex); any other policy from IndexPolicy.hpp may be given as Index
 // -> robin hood bucket stealing
 // -> cacheline sized and aligned buckets
 // -> linear probing
+// -> backward shift deletion (removing a key moves later keys of it's cluster back into the hole, so there are no tombstones and probes do not get longer over time)
 // -> a probe limit of two cachelines (as adjacent cachelines usually get prefetched)
 //    -> if probe limit is reached when inserting, table size is doubled
 //    -> guarantees an element will be reachable with no more than two cache misses (most likely one, however)
+//    -> the table only shrinks on shrink_to_fit(), or when the load factor drops below shrink_load_percent if auto_shrink is set (which also keeps count() at O(1))
+//    -> if incremental_resize is set, the old table is kept around and moved over a few slots per operation instead of all at once (see begin_migration())
+// -> if store_hash is set, the full (mixed) hash of every key is kept in an extra column (hashes()) and used instead of rehashing when resizing/backward shifting, and compared before calling eq()
+//    -> costs sizeof( size_t ) per slot, worth it for keys that are expensive to hash or compare (e.g. strings)
+// -> tables are allocated through Alloc (see Allocator.hpp), e.g. HugePageAllocator to cut down on TLB misses in large tables
+// -> one control byte per slot (empty/full + 7 bit hash fragment, see ControlBytes.hpp), a probe compares a whole group of these at once and only calls eq() on fragment hits
+// -> keys and values are placed by Layout (see Layout.hpp), SplitLayout (all keys, then all values) by default, which the two cacheline guarantee above refers to
+//    -> AutoLayout/InterleavedLayout may be given to put small keys and values side by side in cacheline sized buckets: a hit then costs the control bytes and a single cacheline of keys and values, but a probe window of probe_limit slots spans up to ( probe_limit / slots_per_bucket ) cachelines of keys and values (e.g. 4 for u32 -> u32), which only control byte hits touch
 // CONSTRAINTS:
 // Key:
 //   -> 64 % sizeof( Key ) == 0 (currently not enforced by compiler)
 //   -> must be copy constructible
+//   -> is moved (or memcpy'd if is_trivially_relocatable) when the table is resized
 //   -> must set aside an "empty"/"null" value
 // Value:
 //   -> must be copy constructible
 //
 // Invariants:
 //   -> for a given position i \in \{ 0 ... length() \} :
-//       -> if the key located at keys()[i] is the empty key, then values()[i] does not contain anything (the value at that position has been destroyed/never constructed)
-//       -> if the key located at keys()[i] is not the empty key, then values()[i] must contain a valid instance of V
-//   -> if a key hashes to position i and is present in the map, it must be either within the cacheline of keys()[i] or the next cacheline (at insert, if this would not be the case, the size of the map is doubled)
+//       -> if the key located at key( i ) is the empty key, then value( i ) does not contain anything (the value at that position has been destroyed/never constructed)
+//       -> if the key located at key( i ) is not the empty key, then value( i ) must contain a valid instance of V
+//       -> ctrl()[i] is ctrl_empty if and only if the key located at key( i ) is the empty key, otherwise it is the fragment of the hash of key( i )
+//       -> ctrl()[i] is never ctrl_dead for the current table; tables that are being migrated from or torn down use it to mark slots whose contents have been relocated
+//   -> ctrl() is followed by ctrl_padding bytes that are always ctrl_empty, so groups may be loaded past the end of the table
+//   -> if a key hashes to position i and is present in the map, it must be within the probe_limit slots from window_start( i ) on, i.e. the cacheline of key( i ) or the next one for split layouts (at insert, if this would not be the case, the size of the map is doubled)
 //
 // Performance characteristics:
 //   -> in big-O notation:
 //       -> insert: best O(1) average O(1) worst O(n)
-//       -> enlarge: O(n) (doubling size, filling rest of keys in map with empty key)
-//       -> remove: best O(1) average O(1) worst O(n)
+//       -> enlarge: O(n) (doubling size, filling rest of keys in map with empty key), O(1) per operation with incremental_resize
+//       -> remove: O(1) (backward shift deletion moves at most probe_limit keys, see backward_shift())
 //       -> get: O(1) (result is guaranteed to be within two cachelines of where it should be)
 //       -> clear: O(n)
 //       -> foreach: O(n)
+//       -> parallel_foreach/parallel_reduce: O(n / threads), split into cacheline aligned chunks (see Parallel.hpp)
 //       -> construct: O(1)
+//       -> construct from n elements (bulk): O(n log n) (sorts by home slot, but never resizes after the initial reserve() unless the probe limit is hit)
 //       -> destroy: O(n)
 //   -> when using integer keys \in \{ 0 ... length() \}, a maximum load factor of >90% can be achieved
 //       -> this is the general use case for most hashmaps in this engine, which map from id to a large object.
@@ -59,10 +75,18 @@
 #include <cmath>
 #include <cstdio>
 #include <cassert>
+#include <cstddef>
+
+#include <vector>
+#include <algorithm>
 
 #include "Optional.hpp"
 #include "StaticHashMap.hpp"
 #include "AlignedPointerContainer.hpp"
+#include "ControlBytes.hpp"
+#include "Allocator.hpp"
+#include "Layout.hpp"
+#include "Parallel.hpp"
 
 #include "utils.hpp"
 
@@ -71,21 +95,66 @@
 namespace LibSio
 {
 
+namespace detail
+{
+
+// state only needed when resizing incrementally, empty otherwise
+template< bool incremental_resize >
+struct HashMapResizeState
+{};
+
+template<>
+struct HashMapResizeState< true >
+{
+    // table that is being migrated away from (null pointer if not migrating), slots below migrated_slots have been moved over already
+    AlignedPointerContainer< byte, size_t, 64 > old_underlying;
+    size_t migrated_slots = 0;
+};
+
+// element count, only kept if the map shrinks by itself, empty otherwise
+template< bool auto_shrink >
+struct HashMapCountState
+{};
+
+template<>
+struct HashMapCountState< true >
+{
+    size_t elements = 0;
+};
+
+}
+
 template< typename K, typename V
         , size_t ( *_hash )( const K* const x ) = standard_hash< K >
-        , bool ( *eq )( const K* const a, const K* const b ) = standard_eq< K > >
+        , bool ( *eq )( const K* const a, const K* const b ) = standard_eq< K >
+        , typename Index = MaskIndex<>
+        , bool incremental_resize = false
+        , bool store_hash = false
+        , bool auto_shrink = false
+        , typename Alloc = DefaultAllocator
+        , typename Layout = SplitLayout< K, V > >
 struct HashMap
+    : detail::HashMapResizeState< incremental_resize >
+    , detail::HashMapCountState< auto_shrink >
 {
-    typedef HashMap< K, V, _hash, eq > own_type;
+    typedef HashMap< K, V, _hash, eq, Index, incremental_resize, store_hash, auto_shrink, Alloc, Layout > own_type;
 
     static const size_t initial_length = 7; // 2^7 = 128
     static const size_t no_index = __SIZE_MAX__;
-    static const size_t probe_limit = ( 64 * 2 ) / sizeof( K ); // try to make sure a key is within two cachelines of where it should be
+    static const size_t keys_per_cacheline = 64 / sizeof( K );
+    static const size_t probe_limit = keys_per_cacheline * 2; // try to make sure a key is within two cachelines of where it should be
+    static const size_t ctrl_padding = probe_limit + detail::ctrl_group_width; // empty control bytes after the end of the table
+    static const size_t migration_step = probe_limit; // slots migrated per operation when resizing incrementally
+    static const size_t reserve_load_percent = 75; // load factor reserve() sizes the table for
+    static const size_t shrink_load_percent = 10; // load factor below which the table is halved if auto_shrink is set (the halved table is at 20% at most, far from needing to grow again)
+    static const size_t get_many_batch = 16; // keys hashed and prefetched ahead of resolving them in get_many()
 
-    // pointer-sized container; do not modify except using set_kvs(), set_length_power() and increase_length_power()
     // LSB to 5: size as a power of two, rest: pointer to kvs array
+    typedef AlignedPointerContainer< byte, size_t, 64 > table_t;
+
+    // pointer-sized container; do not modify except using set_kvs(), set_length_power() and increase_length_power()
     //byte* underlying;
-    AlignedPointerContainer< byte, size_t, 64 > underlying;
+    table_t underlying;
     K empty_key;
 
     // maximum length: 2^(2^6 - 1) = 2^63 (would fill more than the address space even if K = V = char)
@@ -118,128 +187,405 @@ struct HashMap
 
     inline void increase_length_power()
     {
-        underlying.setNum( underlying.num() * 2 );
-        //set_length_power( length_power() + 1 );
+        set_length_power( length_power() + 1 );
     }
 
     inline size_t length()
     {
-        return 1 << length_power();
+        return length_of( underlying );
+    }
+
+    static inline size_t table_len_in_bytes( const size_t length )
+    {
+        const size_t n = ctrl_offset( length ) + length + ctrl_padding;
+        return ( n + 63 ) & ~( ( size_t ) 63 ); // whole cachelines
+    }
+
+    // allocates a table for 2^length_power() elements, with all slots empty
+    inline void alloc_table()
+    {
+        set_kvs( ( byte* ) Alloc::alloc( table_len_in_bytes( length() ), 64 ) );
+        assert( kvs() );
+        for ( size_t i = 0; i < length(); i++ ) {
+            new( key( i ) ) K( empty_key );
+        }
+        memset( ctrl(), detail::ctrl_empty, length() + ctrl_padding );
+    }
+
+    // destroys everything in a table and frees it
+    static inline void destroy_table( table_t t )
+    {
+        for ( size_t i = 0; i < length_of( t ); i++ ) {
+            if ( detail::ctrl_is_full( ctrl_of( t )[i] ) ) {
+                kill_cell_unsafe( t, i );
+            } else if ( ctrl_of( t )[i] != detail::ctrl_dead ) {
+                callDestructorIfExistent< K >( key_of( t, i ) );
+            }
+        }
+        Alloc::dealloc( t.ptr(), table_len_in_bytes( length_of( t ) ) );
+    }
+
+    // accessors for any table, the ones without arguments refer to the current table (underlying)
+    static inline size_t length_of( table_t t )
+    {
+        return ( ( size_t ) 1 ) << t.num();
+    }
+
+    // key/value of slot i of table t, wherever Layout puts them
+    static inline K* key_of( table_t t, const size_t i )
+    {
+        return ( K* ) ( t.ptr() + Layout::key_offset( length_of( t ), i ) );
+    }
+
+    static inline V* value_of( table_t t, const size_t i )
+    {
+        return ( V* ) ( t.ptr() + Layout::value_offset( length_of( t ), i ) );
+    }
+
+    // layout: keys and values (see Layout.hpp), hashes (if store_hash), control bytes
+    static inline size_t hashes_offset( const size_t length )
+    {
+        const size_t n = Layout::arr_len_in_bytes( length );
+        return ( n + alignof( size_t ) - 1 ) & ~( alignof( size_t ) - 1 );
     }
 
-    inline K* keys()
+    static inline size_t ctrl_offset( const size_t length )
     {
-        return ( K* ) kvs();
+        return store_hash
+             ? hashes_offset( length ) + length * sizeof( size_t )
+             : Layout::arr_len_in_bytes( length );
     }
 
-    inline V* values()
+    static inline size_t* hashes_of( table_t t )
     {
-        return ( V* ) ( kvs() + key_arr_len_in_bytes< K, V >( length() ) );
+        return ( size_t* ) ( t.ptr() + hashes_offset( length_of( t ) ) );
     }
 
-    // facility for probing backwards to the start of a cacheline
-    static inline K* align_backwards_to_cacheline( K* x )
+    static inline u8* ctrl_of( table_t t )
     {
-        return ( K* ) ( ( ( intptr_t ) x ) & ( ~( ( intptr_t ) 0b111111 ) ) );
+        return t.ptr() + ctrl_offset( length_of( t ) );
+    }
+
+    // mixed hash of the key in (full) slot i of table t
+    static inline size_t cell_hash( table_t t, const size_t i )
+    {
+        if constexpr ( store_hash ) {
+            return hashes_of( t )[i];
+        } else {
+            return hash_full( key_of( t, i ) );
+        }
+    }
+
+    inline K* key( const size_t i )
+    {
+        return key_of( underlying, i );
+    }
+
+    inline V* value( const size_t i )
+    {
+        return value_of( underlying, i );
+    }
+
+    inline u8* ctrl()
+    {
+        return ctrl_of( underlying );
+    }
+
+    // only meaningful if store_hash is set
+    inline size_t* hashes()
+    {
+        return hashes_of( underlying );
+    }
+
+    inline bool is_full( const size_t i )
+    {
+        return detail::ctrl_is_full( ctrl()[i] );
+    }
+
+    // mixed hash of k, see IndexPolicy.hpp
+    static inline size_t hash_full( const K* const k )
+    {
+        return Index::mix( _hash( k ) );
     }
 
     inline size_t hash( const K* const k )
     {
-        return hash_secondary< K, _hash >( k ) % length();//& power_mask( length_power );
+        return Index::index( hash_full( k ), length() );
+    }
+
+    // first slot of the probe window for a given home slot
+    static inline size_t window_start( const size_t hashed )
+    {
+        return hashed & ~( keys_per_cacheline - 1 );
     }
 
   //private:
     // NOTE: due to only keeping the size as a power of two, size may only be doubled or halved
     // trigger for doubling size: insert/emplace goes over probe limit
+    // rehashes the whole table in one go
     inline void double_size()
     {
-        byte hm[sizeof( own_type )];
-        ( ( own_type* ) hm ) -> underlying = underlying;
-        new( &( ( ( own_type* ) hm ) -> empty_key ) ) K( empty_key );
+        resize_to_power( length_power() + 1 );
+    }
 
-        increase_length_power();//length_power++;
+    // smallest length power for which n elements are at most at reserve_load_percent
+    static inline size_t length_power_for( const size_t n )
+    {
+        size_t lp = initial_length;
+        while ( ( ( ( size_t ) 1 ) << lp ) * reserve_load_percent < n * 100 ) {
+            lp++;
+        }
+        return lp;
+    }
 
-        set_kvs( ( byte* ) aligned_alloc( 64, overall_arr_len_in_bytes< K, V >( length() ) ) );
-        for ( size_t i = 0; i < length(); i++ ) {
-            new( keys() + i ) K( empty_key );
+    // moves everything into a new table of length 2^lp, in one go
+    inline void resize_to_power( const size_t lp )
+    {
+        table_t old = underlying;
+
+        set_length_power( lp );
+        alloc_table();
+
+        for ( size_t i = 0; i < length_of( old ); i++ ) {
+            if ( detail::ctrl_is_full( ctrl_of( old )[i] ) ) {
+                relocate_cell( old, i, cell_hash( old, i ) );
+            }
         }
 
-        own_type* self = this;
-        ( ( own_type* ) hm ) -> foreach_lambda(
-            [=]
-            ( const K* k, V* v )
-            -> void
-            {
-                self -> insert( *k, *v );
+        destroy_table( old ); // only empty keys left in there
+    }
+
+    // incremental resizing: the current table becomes the old table, a new table of twice the size is allocated.
+    // Every operation then moves migration_step slots from the old table to the new one, until the old table is empty and gets freed.
+    // Until then, lookups check both tables. Lookups in the old table do not stop at the first empty slot, as migration leaves holes in probe windows.
+    inline bool migrating()
+    {
+        if constexpr ( incremental_resize ) {
+            return this -> old_underlying.ptr() != nullptr;
+        } else {
+            return false;
+        }
+    }
+
+    // table being migrated away from, only valid if migrating()
+    inline table_t old_table()
+    {
+        if constexpr ( incremental_resize ) {
+            return this -> old_underlying;
+        } else {
+            return table_t();
+        }
+    }
+
+    inline size_t migrated()
+    {
+        if constexpr ( incremental_resize ) {
+            return this -> migrated_slots;
+        } else {
+            return 0;
+        }
+    }
+
+    inline void begin_migration()
+    {
+        if constexpr ( incremental_resize ) {
+            this -> old_underlying = underlying;
+            this -> migrated_slots = 0;
+            increase_length_power();
+            alloc_table();
+        }
+    }
+
+    inline void migrate( const size_t n )
+    {
+        if constexpr ( incremental_resize ) {
+            table_t old = this -> old_underlying;
+            // n may be no_index (migrate everything), so compare against what is left instead of adding n to migrated_slots
+            const size_t end = n < length_of( old ) - this -> migrated_slots
+                             ? this -> migrated_slots + n
+                             : length_of( old );
+            for ( size_t i = this -> migrated_slots; i < end; i++ ) {
+                if ( detail::ctrl_is_full( ctrl_of( old )[i] ) ) {
+                    relocate_cell( old, i, cell_hash( old, i ) );
+                }
             }
-        );
+            this -> migrated_slots = end;
+            if ( end == length_of( old ) ) {
+                destroy_table( old );
+                this -> old_underlying = table_t();
+            }
+        }
+    }
 
-        ( ( own_type* ) hm ) -> ~HashMap();
+    // makes room after the probe limit was hit
+    inline void grow()
+    {
+        if constexpr ( incremental_resize ) {
+            if ( migrating() ) {
+                migrate( no_index );
+            }
+            begin_migration();
+        } else {
+            double_size();
+        }
+    }
+
+    // moves the element in slot i of table t (which must not be the current table) into the current table, marking slot i as dead
+    inline void relocate_cell( table_t t, const size_t i, const size_t hashed )
+    {
+        size_t n = find_free_slot( hashed );
+        while ( n == no_index ) {
+            double_size();
+            n = find_free_slot( hashed );
+        }
+        callDestructorIfExistent< K >( key( n ) );
+        relocate< K >( key( n ), key_of( t, i ) );
+        relocate< V >( value( n ), value_of( t, i ) );
+        if constexpr ( store_hash ) {
+            hashes()[n] = hashed;
+        }
+        ctrl()[n] = ctrl_of( t )[i];
+        ctrl_of( t )[i] = detail::ctrl_dead;
+    }
+
+    template< typename... Args >
+    inline void construct_cell( const size_t n, const size_t hashed, const K& k, Args... args )
+    {
+        callDestructorIfExistent< K >( key( n ) );
+        new( key( n ) ) K( k );
+        new( value( n ) ) V( args... );
+        if constexpr ( store_hash ) {
+            hashes()[n] = hashed;
+        }
+        ctrl()[n] = detail::ctrl_tag( hashed );
     }
 
     inline void kill_cell( size_t i )
     {
-        kill_cell_unsafe( i );
-        new( keys() + i ) K( empty_key );
+        kill_cell( underlying, i );
+    }
+
+    inline void kill_cell( table_t t, size_t i )
+    {
+        kill_cell_unsafe( t, i );
+        new( key_of( t, i ) ) K( empty_key );
+        ctrl_of( t )[i] = detail::ctrl_empty;
     }
 
     inline void kill_cell_unsafe( size_t i )
     {
-        callDestructorIfExistent< K >( keys() + i );
-        callDestructorIfExistent< V >( values() + i );
+        kill_cell_unsafe( underlying, i );
     }
 
-    size_t get_index_for_key( const K* const k )
+    static inline void kill_cell_unsafe( table_t t, size_t i )
     {
-        const size_t hashed = hash( k );
-        K* const probe_start = align_backwards_to_cacheline( keys() + hashed );
-        K* const arr_end =  keys() + length();
-        K* const probe_end = probe_start + probe_limit > arr_end
-                           ? arr_end
-                           : probe_start + probe_limit;
-        for ( K* i = probe_start
-            ;    i < probe_end
-              && !eq( i, &empty_key )
-            ; i++
-            ) {
-            if ( eq( i, k ) ) {
-                return ( size_t ) ( ( ( ( intptr_t ) i ) - ( ( intptr_t ) keys() ) ) / sizeof( K ) );
+        callDestructorIfExistent< K >( key_of( t, i ) );
+        callDestructorIfExistent< V >( value_of( t, i ) );
+    }
+
+    // walks the probe window of k (whose mixed hash is hashed) in table t up to the first empty slot (or over the whole window if stop_at_empty is false), one group of control bytes at a time
+    // returns the index of k if present, no_index otherwise
+    // free_slot (if given) is set to the first empty slot within the window, or no_index if the window is full
+    static size_t probe( table_t t, const K* const k, const size_t hashed, size_t* const free_slot = nullptr, const bool stop_at_empty = true )
+    {
+        return probe_with(
+            t
+          , [=]
+            ( const K* const x )
+            -> bool
+            {
+                return eq( x, k );
+            }
+          , hashed
+          , free_slot
+          , stop_at_empty
+        );
+    }
+
+    // probe() with matches( key ) in place of eq( key, k )
+    template< typename M >
+    static size_t probe_with( table_t t, M matches, const size_t hashed, size_t* const free_slot = nullptr, const bool stop_at_empty = true )
+    {
+        const size_t length = length_of( t );
+        const u8* const ctrl = ctrl_of( t );
+        const u8 tag = detail::ctrl_tag( hashed );
+        const size_t probe_start = window_start( Index::index( hashed, length ) );
+        const size_t probe_end = probe_start + probe_limit > length
+                               ? length
+                               : probe_start + probe_limit;
+        for ( size_t g = probe_start; g < probe_end; g += detail::ctrl_group_width ) {
+            const detail::CtrlGroup group( ctrl + g );
+            const u32 empties = stop_at_empty ? group.match_empty() : 0;
+            u32 hits = group.match( tag );
+            if ( empties ) {
+                hits &= detail::ctrl_bits_below( __builtin_ctz( empties ) );
+            }
+            for ( ; hits; hits &= hits - 1 ) {
+                const size_t i = g + __builtin_ctz( hits );
+                if ( i >= probe_end ) {
+                    break;
+                }
+                if ( store_hash && hashes_of( t )[i] != hashed ) {
+                    continue;
+                }
+                if ( matches( key_of( t, i ) ) ) {
+                    return i;
+                }
+            }
+            if ( empties ) {
+                const size_t i = g + __builtin_ctz( empties );
+                if ( free_slot ) {
+                    *free_slot = i < probe_end ? i : no_index;
+                }
+                return no_index;
             }
         }
+        if ( free_slot ) {
+            *free_slot = no_index;
+        }
         return no_index;
     }
 
-    static inline ptrdiff_t distance( const size_t x, const size_t y )
+    // first empty slot in the probe window for hashed in the current table, no_index if there is none
+    size_t find_free_slot( const size_t hashed )
     {
-        return std::abs( ( ( ptrdiff_t ) x ) - ( ( ptrdiff_t ) y ) );
+        const size_t probe_start = window_start( Index::index( hashed, length() ) );
+        const size_t probe_end = probe_start + probe_limit > length()
+                               ? length()
+                               : probe_start + probe_limit;
+        for ( size_t g = probe_start; g < probe_end; g += detail::ctrl_group_width ) {
+            const u32 empties = detail::CtrlGroup( ctrl() + g ).match_empty();
+            if ( empties ) {
+                const size_t i = g + __builtin_ctz( empties );
+                return i < probe_end ? i : no_index;
+            }
+        }
+        return no_index;
     }
 
-    void reshuffle( const size_t start )
+    // index of k in the current table (does not look into the old table while resizing incrementally)
+    size_t get_index_for_key( const K* const k )
     {
-        // TODO: may not work entirely correctly, write more tests
-        if ( !eq( keys() + start, &empty_key ) ) {
-            return;
-        }
+        return probe( underlying, k, hash_full( k ) );
+    }
 
-        // is there anything within the probe limit that wants to be in this cacheline? If so, start shuffling (might reshuffle literally every other element in the map, but that should be extremely rare as we are unlikely to reach the load factor required for that)
-        const size_t probe_start = start;
-        const size_t probe_end = start + probe_limit < length() ? start + probe_limit : length();
-        for ( size_t i = probe_start + 1; i < probe_end && !eq( keys() + i, &empty_key ); i++ ) {
-            const size_t hash_curr = hash( keys() + i );
-            const ptrdiff_t dist_i = distance( i, hash_curr );
-            const ptrdiff_t dist_start = distance( start, hash_curr );
-            // test whether dist_start might still have element at i end up on the correct cacheline and whether start is at a lower distance than i
-            if ( keys() + start >= align_backwards_to_cacheline( keys() + hash_curr )
-                 && dist_i > dist_start && eq( keys() + i, &empty_key ) ) {
-                callDestructorIfExistent< K >( keys() + i );
-                new( keys() + i ) K( keys()[start] );
-                new( values() + i ) V( values()[start] );
-                callDestructorIfExistent< K >( keys() + start );
-                callDestructorIfExistent< V >( values() + start );
-                //memcpy( keys() + start, keys() + i, sizeof( K ) );
-                //memcpy( values() + start, values() + i, sizeof( V ) );
-                new( keys() + i ) K( empty_key );
-                return reshuffle( i );
+    // backward shift deletion (Knuth's algorithm R): fills the hole at slot hole left by a removal, so lookups (which stop at the first empty slot of a window) still find everything
+    // moves every later key of the cluster whose probe window starts at or before the hole into it, which leaves a new hole where that key was, and so on.
+    // No key further than probe_limit slots after a hole can have it's window start at or before it, so this stops there at the latest.
+    void backward_shift( size_t hole )
+    {
+        for ( size_t i = hole + 1; i < length() && i < hole + probe_limit && is_full( i ); i++ ) {
+            if ( window_start( Index::index( cell_hash( underlying, i ), length() ) ) <= hole ) {
+                callDestructorIfExistent< K >( key( hole ) );
+                relocate< K >( key( hole ), key( i ) );
+                relocate< V >( value( hole ), value( i ) );
+                if constexpr ( store_hash ) {
+                    hashes()[hole] = hashes()[i];
+                }
+                ctrl()[hole] = ctrl()[i];
+                new( key( i ) ) K( empty_key );
+                ctrl()[i] = detail::ctrl_empty;
+                hole = i;
             }
         }
     }
@@ -251,56 +597,358 @@ struct HashMap
         , empty_key( _empty_key )
     {
         set_length_power( initial_length );
-        set_kvs( ( byte* ) aligned_alloc( 64, overall_arr_len_in_bytes< K, V >( length() ) ) );
-        assert( kvs() );
-        for ( size_t i = 0; i < length(); i++ ) {
-            new( keys() + i ) K( empty_key );
-        }
+        alloc_table();
     }
 
-    HashMap( HashMap& x )
-        : HashMap( x.empty_key )
+    // bulk construction: sized for all count elements up front (if a key appears more than once, the first one wins)
+    HashMap( K _empty_key, const K* const keys, const V* const values, const size_t count )
+        : HashMap( _empty_key )
     {
-        HashMap< K, V, _hash, eq >* self = this;
-        x.foreach_lambda(
-            [=]
-            ( const K* k, V* v )
+        bulk_insert(
+            count
+          , [=]
+            ( const size_t i )
+            -> const K*
+            {
+                return keys + i;
+            }
+          , [=]
+            ( const size_t hashed, const size_t i )
             -> void
             {
-                self -> insert( *k, *v );
+                emplace_hashed( hashed, keys[i], values[i] );
             }
         );
     }
 
-    ~HashMap()
+    // bulk construction from a range of pair-like elements (it -> first is the key, it -> second the value), It must be at least a forward iterator
+    template< typename It >
+    HashMap( K _empty_key, It begin, It end )
+        : HashMap( _empty_key )
     {
-        for ( size_t i = 0; i < length(); i++ ) {
-            if ( !( eq( keys() + i, &empty_key ) ) ) {
-                kill_cell_unsafe( i );
-            } else {
-                callDestructorIfExistent< K >( keys() + i );
+        std::vector< It > its;
+        for ( It it = begin; it != end; ++it ) {
+            its.push_back( it );
+        }
+        bulk_insert(
+            its.size()
+          , [&]
+            ( const size_t i )
+            -> const K*
+            {
+                return &( its[i] -> first );
+            }
+          , [&]
+            ( const size_t hashed, const size_t i )
+            -> void
+            {
+                emplace_hashed( hashed, its[i] -> first, its[i] -> second );
+            }
+        );
+    }
+
+    // makes sure the table is large enough for n elements in total (assuming a load factor of reserve_load_percent), only ever grows the table
+    void reserve( const size_t n )
+    {
+        const size_t lp = length_power_for( n );
+        if ( lp > length_power() ) {
+            if ( migrating() ) {
+                migrate( no_index );
+            }
+            resize_to_power( lp );
+        }
+    }
+
+    // shrinks the table to the smallest size that fits everything in it (assuming a load factor of reserve_load_percent), never below 2^initial_length
+    void shrink_to_fit()
+    {
+        if ( migrating() ) {
+            migrate( no_index );
+        }
+        const size_t lp = length_power_for( count() );
+        if ( lp < length_power() ) {
+            resize_to_power( lp );
+        }
+    }
+
+    // auto_shrink: halves the table once the load factor drops below shrink_load_percent (not while migrating)
+    inline void maybe_shrink()
+    {
+        if constexpr ( auto_shrink ) {
+            if ( !migrating()
+                 && length_power() > initial_length
+                 && this -> elements * 100 < length() * shrink_load_percent ) {
+                resize_to_power( length_power() - 1 );
+            }
+        }
+    }
+
+    // number of elements: O(1) if auto_shrink is set, counts them in O(n) otherwise
+    size_t count()
+    {
+        if constexpr ( auto_shrink ) {
+            return this -> elements;
+        } else {
+            size_t n = 0;
+            foreach_cell(
+                [&]
+                ( __attribute__((unused)) const K* _k, __attribute__((unused)) V* _v )
+                -> void
+                {
+                    n++;
+                }
+            );
+            return n;
+        }
+    }
+
+    inline void count_elements( const ptrdiff_t n )
+    {
+        if constexpr ( auto_shrink ) {
+            this -> elements += n;
+        }
+    }
+
+    // inserts count elements, ordered by their home slot so the table is filled front to back (in probe window order)
+    // key_at( i ) returns a pointer to the i-th key, emplace_at( hashed, i ) emplaces the i-th element
+    template< typename KeyAt, typename EmplaceAt >
+    void bulk_insert( const size_t count, KeyAt key_at, EmplaceAt emplace_at )
+    {
+        struct entry
+        {
+            size_t home;
+            size_t hashed;
+            size_t i;
+        };
+
+        reserve( count );
+        std::vector< entry > order;
+        order.reserve( count );
+        for ( size_t i = 0; i < count; i++ ) {
+            if ( !eq( key_at( i ), &empty_key ) ) {
+                const size_t hashed = hash_full( key_at( i ) );
+                order.push_back( entry { Index::index( hashed, length() ), hashed, i } );
+            }
+        }
+        std::stable_sort(
+            order.begin()
+          , order.end()
+          , []
+            ( const entry& a, const entry& b )
+            -> bool
+            {
+                return a.home < b.home;
             }
+        );
+        for ( const entry& e : order ) {
+            emplace_at( e.hashed, e.i );
+        }
+    }
+
+    // copies slot for slot, so nothing needs to be rehashed
+    HashMap( HashMap& x )
+        : underlying()
+        , empty_key( x.empty_key )
+    {
+        if ( x.migrating() ) {
+            set_length_power( initial_length );
+            alloc_table();
+            own_type* self = this;
+            x.foreach_lambda(
+                [=]
+                ( const K* k, V* v )
+                -> void
+                {
+                    self -> insert( *k, *v );
+                }
+            );
+        } else if constexpr ( std::is_trivially_copyable< K >::value && std::is_trivially_copyable< V >::value ) {
+            set_length_power( x.length_power() );
+            set_kvs( ( byte* ) Alloc::alloc( table_len_in_bytes( length() ), 64 ) );
+            assert( kvs() );
+            memcpy( kvs(), x.kvs(), table_len_in_bytes( length() ) );
+            count_elements( x.count() );
+        } else {
+            set_length_power( x.length_power() );
+            alloc_table();
+            for ( size_t i = 0; i < length(); i++ ) {
+                if ( x.is_full( i ) ) {
+                    callDestructorIfExistent< K >( key( i ) );
+                    new( key( i ) ) K( *( x.key( i ) ) );
+                    new( value( i ) ) V( *( x.value( i ) ) );
+                    ctrl()[i] = x.ctrl()[i];
+                    if constexpr ( store_hash ) {
+                        hashes()[i] = x.hashes()[i];
+                    }
+                }
+            }
+            count_elements( x.count() );
+        }
+    }
+
+    // takes over the table(s) of x, x is left without one (and may only be destroyed or assigned to)
+    HashMap( HashMap&& x )
+        : detail::HashMapResizeState< incremental_resize >( x )
+        , detail::HashMapCountState< auto_shrink >( x )
+        , underlying( x.underlying )
+        , empty_key( x.empty_key )
+    {
+        x.underlying = table_t();
+        if constexpr ( incremental_resize ) {
+            x.old_underlying = table_t();
+        }
+    }
+
+    ~HashMap()
+    {
+        if ( migrating() ) {
+            destroy_table( old_table() );
+        }
+        if ( kvs() ) {
+            destroy_table( underlying );
         }
-        free( kvs() );
     }
 
     HashMap& operator=( HashMap& x )
     {
-        this -> ~HashMap< K, V, _hash, eq >();
-        new( this ) HashMap< K, V, _hash, eq >( x );
+        this -> ~HashMap();
+        new( this ) own_type( x );
+        return *this;
+    }
+
+    HashMap& operator=( HashMap&& x )
+    {
+        this -> ~HashMap();
+        new( this ) own_type( std::move( x ) );
         return *this;
     }
 
     V* get_ref( const K& k )
     {
-        auto index = get_index_for_key( &k );
+        return get_ref_with(
+            hash_full( &k )
+          , [&]
+            ( const K* const x )
+            -> bool
+            {
+                return eq( x, &k );
+            }
+        );
+    }
+
+    // get_ref for a key with mixed hash hashed that matches( key ) is true for
+    template< typename M >
+    V* get_ref_with( const size_t hashed, M matches )
+    {
+        if ( migrating() ) {
+            migrate( migration_step );
+        }
+        return find_ref_with( hashed, matches );
+    }
+
+    // get_ref_with without a migration step, so it never moves or frees anything: looks in the current table, then in the old one
+    template< typename M >
+    V* find_ref_with( const size_t hashed, M matches )
+    {
+        size_t index = probe_with( underlying, matches, hashed );
         if ( index != no_index ) {
-            return values() + index;
+            return value( index );
+        }
+        if ( migrating() ) {
+            index = probe_with( old_table(), matches, hashed, nullptr, false );
+            if ( index != no_index ) {
+                return value_of( old_table(), index );
+            }
+        }
+        return nullptr;
+    }
+
+    // get_ref for n keys at once: out[i] = get_ref( ks[i] )
+    // hashes a batch of keys and prefetches their probe windows before resolving any of them, so the cache misses overlap
+    // takes a single migration step up front and then resolves every key without migrating, so no lookup moves the slot of an earlier one: the pointers in out stay valid until the next call that modifies the map
+    void get_many( const K* const ks, const size_t n, V** const out )
+    {
+        if ( migrating() ) {
+            migrate( migration_step );
+        }
+        size_t hashed[get_many_batch];
+        for ( size_t b = 0; b < n; b += get_many_batch ) {
+            const size_t batch = n - b < get_many_batch ? n - b : get_many_batch;
+            for ( size_t j = 0; j < batch; j++ ) {
+                hashed[j] = hash_full( ks + b + j );
+                const size_t home = Index::index( hashed[j], length() );
+                const size_t start = window_start( home );
+                __builtin_prefetch( ctrl() + start );
+                __builtin_prefetch( key( home ) );
+                __builtin_prefetch( value( home ) ); // same cacheline as the key if keys and values are interleaved
+                if constexpr ( Layout::slots_per_bucket == 0 ) {
+                    __builtin_prefetch( key( start + keys_per_cacheline ) );
+                }
+                if constexpr ( store_hash ) {
+                    __builtin_prefetch( hashes() + start );
+                }
+            }
+            for ( size_t j = 0; j < batch; j++ ) {
+                const K* const k = ks + b + j;
+                out[b + j] = find_ref_with(
+                    hashed[j]
+                  , [=]
+                    ( const K* const x )
+                    -> bool
+                    {
+                        return eq( x, k );
+                    }
+                );
+            }
+        }
+    }
+
+    // lookup_key< K, Q > for Q's the map may be searched by (see get_ref( const Q& ))
+    template< typename Q >
+    using lookup_for = typename std::enable_if< detail::heterogeneous_lookup< K, typename std::decay< Q >::type, _hash >::value
+                                              , detail::heterogeneous_lookup< K, typename std::decay< Q >::type, _hash >
+                                              >::type;
+
+    // get_ref/get/rm without constructing a K, e.g. by a const char* or std::string_view for String keys (see lookup_key in utils.hpp)
+    template< typename Q, typename L = lookup_for< Q > >
+    V* get_ref( const Q& q )
+    {
+        return get_ref_with(
+            Index::mix( L::hash( q ) )
+          , [&]
+            ( const K* const x )
+            -> bool
+            {
+                return L::eq( x, q );
+            }
+        );
+    }
+
+    template< typename Q, typename L = lookup_for< Q > >
+    Optional< V > get( const Q& q )
+    {
+        V* x = get_ref( q );
+        if ( x ) {
+            return Just< V >( *x );
         } else {
-            return nullptr;
+            return Nothing< V >();
         }
     }
 
+    template< typename Q, typename L = lookup_for< Q > >
+    void rm( const Q& q )
+    {
+        rm_with(
+            Index::mix( L::hash( q ) )
+          , [&]
+            ( const K* const x )
+            -> bool
+            {
+                return L::eq( x, q );
+            }
+        );
+    }
+
     Optional< V > get( const K& k )
     {
         V* x = get_ref( k );
@@ -323,53 +971,127 @@ struct HashMap
         if ( eq( &empty_key, &k ) ) {
             return false; // attempting to insert empty key
         }
-        const size_t hashed = hash( &k );
-        const K* probe_start = align_backwards_to_cacheline( keys() + hashed );
-        const K* arr_end = keys() + length();
-        const K* probe_end = probe_start + probe_limit > arr_end
-                           ? arr_end
-                           : probe_start + probe_limit;
-        K* i = ( K* ) probe_start;
-        for ( // nothing
-            ;    i < probe_end
-              && !eq( i, &empty_key )
-            ; i++
-            ) {
-            if ( eq( i, &k ) ) {
+        return emplace_hashed( hash_full( &k ), k, args... );
+    }
+
+    // emplace with the mixed hash of k already computed
+    template< typename... Args >
+    bool emplace_hashed( const size_t hashed, const K& k, Args... args )
+    {
+        if ( migrating() ) {
+            migrate( migration_step );
+            if ( migrating() && probe( old_table(), &k, hashed, nullptr, false ) != no_index ) {
                 return false; // key already in map
             }
         }
-        if ( i == probe_end ) {
-            double_size();
-            return emplace< Args... >( k, args... );
+        size_t n = no_index;
+        if ( probe( underlying, &k, hashed, &n ) != no_index ) {
+            return false; // key already in map
+        }
+        if ( n == no_index ) {
+            grow();
+            return emplace_hashed< Args... >( hashed, k, args... );
         } else {
-            // found space at i
-            size_t n = ( size_t ) ( ( ( intptr_t ) i ) - ( ( intptr_t ) keys() ) ) / sizeof( K );
-            V* j = values() + n;
-
-            callDestructorIfExistent< K >( i );
-            new( i ) K( k );
-            new( j ) V( args... );
+            // found space at n
+            construct_cell( n, hashed, k, args... );
+            count_elements( 1 );
             return true;
         }
     }
 
     void rm( const K& k )
     {
-        auto index = get_index_for_key( &k );
+        rm_with(
+            hash_full( &k )
+          , [&]
+            ( const K* const x )
+            -> bool
+            {
+                return eq( x, &k );
+            }
+        );
+    }
+
+    // rm for a key with mixed hash hashed that matches( key ) is true for
+    template< typename M >
+    void rm_with( const size_t hashed, M matches )
+    {
+        if ( migrating() ) {
+            migrate( migration_step );
+        }
+        size_t index = probe_with( underlying, matches, hashed );
         if ( index != no_index ) {
             kill_cell( index );
-            reshuffle( index );
+            backward_shift( index );
+            count_elements( -1 );
+            maybe_shrink();
+        } else if ( migrating() ) {
+            // lookups in the old table do not stop at holes, so no backward shift necessary
+            index = probe_with( old_table(), matches, hashed, nullptr, false );
+            if ( index != no_index ) {
+                kill_cell_unsafe( old_table(), index );
+                ctrl_of( old_table() )[index] = detail::ctrl_dead;
+                count_elements( -1 );
+            }
+        }
+    }
+
+    // removes every element pred( key, value ) is true for, in one pass over the table (finishes an incremental resize first)
+    template< typename P >
+    void rm_if( P pred )
+    {
+        if ( migrating() ) {
+            migrate( no_index );
+        }
+        for ( size_t i = 0; i < length(); ) {
+            if ( is_full( i ) && pred( ( const K* ) key( i ), value( i ) ) ) {
+                kill_cell( i );
+                backward_shift( i );
+                count_elements( -1 );
+                // backward shift may have moved a later (not yet looked at) element into slot i
+            } else {
+                i++;
+            }
         }
+        maybe_shrink();
     }
 
     void clear()
     {
+        if ( migrating() ) {
+            destroy_table( old_table() );
+            if constexpr ( incremental_resize ) {
+                this -> old_underlying = table_t();
+            }
+        }
         for ( size_t i = 0; i < length(); i++ ) {
-            if ( !( eq( keys() + i, &empty_key ) ) ) {
+            if ( is_full( i ) ) {
                 kill_cell( i );
             }
         }
+        if constexpr ( auto_shrink ) {
+            this -> elements = 0;
+            shrink_to_fit();
+        }
+    }
+
+    // calls fn( key, value ) for every element, in the old table as well while resizing incrementally
+    template< typename F >
+    inline void foreach_cell( F fn )
+    {
+        for ( size_t i = 0; i < length(); i++ ) {
+            if ( is_full( i ) ) {
+                fn( key( i ), value( i ) );
+            }
+        }
+        if ( migrating() ) {
+            table_t old = old_table();
+            for ( size_t i = migrated(); i < length_of( old ); i++ ) {
+                if ( detail::ctrl_is_full( ctrl_of( old )[i] ) ) {
+                    fn( key_of( old, i ), value_of( old, i ) );
+                }
+            }
+        }
     }
 
     struct foreach_frame
@@ -382,38 +1104,134 @@ struct HashMap
 
     void foreach_value( void ( *fn )( V* value ) )
     {
-        for ( size_t i = 0; i < length(); i++ ) {
-            if ( !eq( keys() + i, &empty_key ) ) {
-                fn( values() + i );
+        foreach_cell(
+            [&]
+            ( __attribute__((unused)) const K* _, V* v )
+            -> void
+            {
+                fn( v );
             }
-        }
+        );
     }
 
-    void foreach_value_lambda( std::function< void( V* ) > fn )
+    template< typename F >
+    void foreach_value_lambda( F fn )
     {
-        for ( size_t i = 0; i < length(); i++ ) {
-            if ( !eq( keys() + i, &empty_key ) ) {
-                fn( values() + i );
+        foreach_cell(
+            [&]
+            ( __attribute__((unused)) const K* _, V* v )
+            -> void
+            {
+                fn( v );
             }
-        }
+        );
     }
 
     void foreach( void ( *fn )( const K* key, V* value ) )
     {
-        for ( size_t i = 0; i < length(); i++ ) {
-            if ( !eq( keys() + i, &empty_key ) ) {
-                fn( keys() + i, values() + i );
+        foreach_cell( fn );
+    }
+
+    template< typename F >
+    void foreach_lambda( F fn )
+    {
+        foreach_cell( fn );
+    }
+
+    // foreach/foreach_value for any callable (lambdas with captures, function objects), which unlike std::function can be inlined
+    template< typename F >
+    void foreach( F fn )
+    {
+        foreach_lambda( fn );
+    }
+
+    template< typename F >
+    void foreach_value( F fn )
+    {
+        foreach_value_lambda( fn );
+    }
+
+    // foreach_cell on up to threads threads at once (0: one per hardware thread), see Parallel.hpp
+    // calls fn( worker, key, value ) concurrently, for different elements
+    template< typename F >
+    void parallel_foreach_cell( F fn, const size_t threads )
+    {
+        const size_t n = length();
+        const size_t old_start = migrated();
+        const size_t old_n = migrating() ? length_of( old_table() ) - old_start : 0;
+        // one range over both tables, the old table's rest is appended after the current table
+        detail::parallel_chunks(
+            n + old_n
+          , keys_per_cacheline
+          , threads
+          , [&]
+            ( const size_t worker, const size_t begin, const size_t end )
+            -> void
+            {
+                for ( size_t i = begin; i < end && i < n; i++ ) {
+                    if ( is_full( i ) ) {
+                        fn( worker, ( const K* ) key( i ), value( i ) );
+                    }
+                }
+                for ( size_t i = ( begin > n ? begin : n ); i < end; i++ ) {
+                    table_t old = old_table();
+                    const size_t j = i - n + old_start;
+                    if ( detail::ctrl_is_full( ctrl_of( old )[j] ) ) {
+                        fn( worker, ( const K* ) key_of( old, j ), value_of( old, j ) );
+                    }
+                }
             }
-        }
+        );
     }
 
-    void foreach_lambda( std::function< void( const K*, V* ) > fn )
+    // fn( key, value ) is called concurrently, for different elements
+    template< typename F >
+    void parallel_foreach( F fn, const size_t threads = 0 )
     {
-        for ( size_t i = 0; i < length(); i++ ) {
-            if ( !eq( keys() + i, &empty_key ) ) {
-                fn( keys() + i, values() + i );
+        parallel_foreach_cell(
+            [&]
+            ( __attribute__((unused)) const size_t worker, const K* k, V* v )
+            -> void
+            {
+                fn( k, v );
+            }
+          , threads
+        );
+    }
+
+    template< typename F >
+    void parallel_foreach_value( F fn, const size_t threads = 0 )
+    {
+        parallel_foreach_cell(
+            [&]
+            ( __attribute__((unused)) const size_t worker, __attribute__((unused)) const K* _, V* v )
+            -> void
+            {
+                fn( v );
+            }
+          , threads
+        );
+    }
+
+    // folds every element into one of a number of per-thread partial results with fn( T& partial, key, value ), each partial starting out as identity
+    // then folds the partials into identity with combine( T& result, const T& partial ) and returns that
+    template< typename T, typename F, typename C >
+    T parallel_reduce( T identity, F fn, C combine, const size_t threads = 0 )
+    {
+        std::vector< detail::ParallelPartial< T > > partials( detail::parallel_thread_count( threads ), detail::ParallelPartial< T > { identity } );
+        parallel_foreach_cell(
+            [&]
+            ( const size_t worker, const K* k, V* v )
+            -> void
+            {
+                fn( partials[worker].value, k, v );
             }
+          , threads
+        );
+        for ( const detail::ParallelPartial< T >& partial : partials ) {
+            combine( identity, partial.value );
         }
+        return identity;
     }
 };
 
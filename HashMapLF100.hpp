@@ -16,6 +16,11 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 // hashmap with a constant 100 percent load factor. Access O(n) max., all other operations O(n)
+// resizing moves the elements over into the resized map (see StaticHashMap::relocate_from) instead of copying them
+#pragma once
+
+#include <vector>
+#include <utility>
 
 #include "StaticHashMap.hpp"
 
@@ -26,10 +31,14 @@ template< typename K
         , typename V
         , size_t ( *_hash )( const K* const x ) = standard_hash< K >
         , bool ( *eq )( const K* const a, const K* const b ) = standard_eq< K >
+        , typename Index = ModuloIndex<> // length changes by 1 at a time, so no policy that needs power of two lengths
+        , typename Alloc = DefaultAllocator
         >
 struct HashMapLF100
 {
-    StaticHashMap< K, V, _hash, eq > underlying;
+    typedef StaticHashMap< K, V, _hash, eq, Index, Alloc > map_type;
+
+    map_type underlying;
 
     HashMapLF100() = delete;
 
@@ -68,30 +77,19 @@ struct HashMapLF100
 
     void increase_size_by_1()
     {
-        StaticHashMap< K, V, _hash, eq > x( underlying );
-        underlying = StaticHashMap< K, V, _hash, eq >( x.length + 1, x.empty_key );
-        x.foreach_lambda(
-            [&]
-          ( const K* k, V* v )
-          -> void
-          {
-              insert( *k, *v );
-          }
-        );
+        map_type x( underlying.length + 1, underlying.empty_key );
+        x.relocate_from( underlying );
+        underlying = std::move( x );
     }
 
     void decrease_size_by_1()
     {
-        StaticHashMap< K, V, _hash, eq > x( underlying );
-        underlying = StaticHashMap< K, V, _hash, eq >( x.length - 1, x.empty_key );
-        x.foreach_lambda(
-            [&]
-            ( const K* k, V* v )
-            -> void
-            {
-                insert( *k, *v );
-            }
-        );
+        if ( underlying.length == 1 ) {
+            return; // StaticHashMap can not be empty
+        }
+        map_type x( underlying.length - 1, underlying.empty_key );
+        x.relocate_from( underlying );
+        underlying = std::move( x );
     }
 
     V* get_ref( const K& k )
@@ -140,7 +138,8 @@ struct HashMapLF100
         underlying.foreach_value( fn );
     }
 
-    void foreach_value_lambda( std::function< void( V* ) > fn )
+    template< typename F >
+    void foreach_value_lambda( F fn )
     {
         underlying.foreach_value_lambda( fn );
     }
@@ -150,11 +149,43 @@ struct HashMapLF100
         underlying.foreach( fn );
     }
 
-    void foreach_lambda( std::function< void( const K*, V* ) > fn )
+    template< typename F >
+    void foreach_lambda( F fn )
     {
         underlying.foreach_lambda( fn );
     }
 
+    // foreach/foreach_value for any callable (lambdas with captures, function objects), which unlike std::function can be inlined
+    template< typename F >
+    void foreach( F fn )
+    {
+        foreach_lambda( fn );
+    }
+
+    template< typename F >
+    void foreach_value( F fn )
+    {
+        foreach_value_lambda( fn );
+    }
+
+    template< typename F >
+    void parallel_foreach( F fn, const size_t threads = 0 )
+    {
+        underlying.parallel_foreach( fn, threads );
+    }
+
+    template< typename F >
+    void parallel_foreach_value( F fn, const size_t threads = 0 )
+    {
+        underlying.parallel_foreach_value( fn, threads );
+    }
+
+    template< typename T, typename F, typename C >
+    T parallel_reduce( T identity, F fn, C combine, const size_t threads = 0 )
+    {
+        return underlying.parallel_reduce( identity, fn, combine, threads );
+    }
+
     bool empty()
     {
         return underlying.empty();
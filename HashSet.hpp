@@ -0,0 +1,286 @@
+/*
+  Hashset with guaranteed O(1) access for amd64 systems.
+  Copyright (C) 2018 Sio Kreuzer
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// HashMap without values: a HashMap whose values are stateless, laid out by KeysOnlyLayout (see Layout.hpp), so a table holds nothing but keys, their control bytes (and hashes, if store_hash is set).
+// -> same probing, resizing and guarantees as HashMap, same template parameters minus V and Layout
+// -> insert() returns false if the key is already in the set (as HashMap::emplace)
+// Set algebra:
+// -> unite/intersect/subtract change this set in place: intersect and subtract only remove keys (in one pass, see HashMap::rm_if), so the keys that stay are never rehashed
+//    -> unite inserts by the hashes x has stored if store_hash is set, so it only rehashes keys without store_hash
+// -> union_of/intersection_of/difference_of build a new set from a copy (slot for slot, no rehashing) of one of the sets and then change that in place, going over whichever set has the shorter table where the result allows it (table lengths are known in O(1), count() is not)
+#pragma once
+
+#include <utility>
+
+#include "HashMap.hpp"
+#include "Layout.hpp"
+
+#include "utils.hpp"
+
+namespace LibSio
+{
+
+template< typename K
+        , size_t ( *_hash )( const K* const x ) = standard_hash< K >
+        , bool ( *eq )( const K* const a, const K* const b ) = standard_eq< K >
+        , typename Index = MaskIndex<>
+        , bool incremental_resize = false
+        , bool store_hash = false
+        , bool auto_shrink = false
+        , typename Alloc = DefaultAllocator >
+struct HashSet
+{
+    typedef HashSet< K, _hash, eq, Index, incremental_resize, store_hash, auto_shrink, Alloc > own_type;
+    typedef HashMap< K, detail::SetValue, _hash, eq, Index, incremental_resize, store_hash, auto_shrink, Alloc, KeysOnlyLayout< K > > map_type;
+
+    map_type underlying;
+
+    HashSet() = delete;
+
+    HashSet( K empty_key )
+        : underlying( empty_key )
+    {}
+
+    // bulk construction: sized for all count keys up front
+    HashSet( K empty_key, const K* const keys, const size_t count )
+        : underlying( empty_key )
+    {
+        underlying.bulk_insert(
+            count
+          , [=]
+            ( const size_t i )
+            -> const K*
+            {
+                return keys + i;
+            }
+          , [&]
+            ( const size_t hashed, const size_t i )
+            -> void
+            {
+                underlying.emplace_hashed( hashed, keys[i] );
+            }
+        );
+    }
+
+    // copies slot for slot, so nothing needs to be rehashed
+    HashSet( own_type& x )
+        : underlying( x.underlying )
+    {}
+
+    // takes over the table of x, x is left without one (and may only be destroyed or assigned to)
+    HashSet( own_type&& x )
+        : underlying( std::move( x.underlying ) )
+    {}
+
+    own_type& operator=( own_type& x )
+    {
+        underlying = x.underlying;
+        return *this;
+    }
+
+    own_type& operator=( own_type&& x )
+    {
+        underlying = std::move( x.underlying );
+        return *this;
+    }
+
+    bool contains( const K& k )
+    {
+        return underlying.get_ref( k ) != nullptr;
+    }
+
+    // contains without constructing a K, see lookup_key in utils.hpp
+    template< typename Q, typename L = typename map_type::template lookup_for< Q > >
+    bool contains( const Q& q )
+    {
+        return underlying.get_ref( q ) != nullptr;
+    }
+
+    // returns true on success, false if k already in set
+    bool insert( const K& k )
+    {
+        return underlying.emplace( k );
+    }
+
+    void rm( const K& k )
+    {
+        underlying.rm( k );
+    }
+
+    template< typename Q, typename L = typename map_type::template lookup_for< Q > >
+    void rm( const Q& q )
+    {
+        underlying.rm( q );
+    }
+
+    // removes every key pred( key ) is true for
+    template< typename P >
+    void rm_if( P pred )
+    {
+        underlying.rm_if(
+            [&]
+            ( const K* k, __attribute__((unused)) detail::SetValue* _ )
+            -> bool
+            {
+                return pred( k );
+            }
+        );
+    }
+
+    void clear()
+    {
+        underlying.clear();
+    }
+
+    void reserve( const size_t n )
+    {
+        underlying.reserve( n );
+    }
+
+    void shrink_to_fit()
+    {
+        underlying.shrink_to_fit();
+    }
+
+    // calls fn( key ) for every key
+    template< typename F >
+    void foreach( F fn )
+    {
+        underlying.foreach_lambda(
+            [&]
+            ( const K* k, __attribute__((unused)) detail::SetValue* _ )
+            -> void
+            {
+                fn( k );
+            }
+        );
+    }
+
+    // foreach on up to threads threads at once (0: one per hardware thread), see Parallel.hpp
+    template< typename F >
+    void parallel_foreach( F fn, const size_t threads = 0 )
+    {
+        underlying.parallel_foreach(
+            [&]
+            ( const K* k, __attribute__((unused)) detail::SetValue* _ )
+            -> void
+            {
+                fn( k );
+            }
+          , threads
+        );
+    }
+
+    // number of slots of the table (of the new table, while an incremental resize is going on)
+    size_t length()
+    {
+        return underlying.length();
+    }
+
+    bool empty()
+    {
+        return count() == 0;
+    }
+
+    // number of keys: O(1) if auto_shrink is set, counts them in O(n) otherwise
+    size_t count()
+    {
+        return underlying.count();
+    }
+
+    // adds every key of x (finishes an incremental resize of x first)
+    void unite( own_type& x )
+    {
+        if ( &x == this ) {
+            return;
+        }
+        map_type& m = x.underlying;
+        if ( m.migrating() ) {
+            m.migrate( map_type::no_index );
+        }
+        for ( size_t i = 0; i < m.length(); i++ ) {
+            if ( m.is_full( i ) ) {
+                underlying.emplace_hashed( map_type::cell_hash( m.underlying, i ), *( m.key( i ) ) );
+            }
+        }
+    }
+
+    // removes every key that is not in x
+    void intersect( own_type& x )
+    {
+        rm_if(
+            [&]
+            ( const K* k )
+            -> bool
+            {
+                return !x.contains( *k );
+            }
+        );
+    }
+
+    // removes every key that is in x, going over whichever of the two sets has the shorter table
+    void subtract( own_type& x )
+    {
+        if ( x.length() < length() ) {
+            x.foreach(
+                [&]
+                ( const K* k )
+                -> void
+                {
+                    rm( *k );
+                }
+            );
+        } else {
+            rm_if(
+                [&]
+                ( const K* k )
+                -> bool
+                {
+                    return x.contains( *k );
+                }
+            );
+        }
+    }
+
+    // a copy of the longer set, with the keys of the shorter one added
+    static own_type union_of( own_type& a, own_type& b )
+    {
+        const bool a_larger = a.length() >= b.length();
+        own_type x( a_larger ? a : b );
+        x.unite( a_larger ? b : a );
+        return x;
+    }
+
+    // a copy of the shorter set, with the keys that are not in the longer one removed
+    static own_type intersection_of( own_type& a, own_type& b )
+    {
+        const bool a_smaller = a.length() <= b.length();
+        own_type x( a_smaller ? a : b );
+        x.intersect( a_smaller ? b : a );
+        return x;
+    }
+
+    // a copy of a, with the keys of b removed
+    static own_type difference_of( own_type& a, own_type& b )
+    {
+        own_type x( a );
+        x.subtract( b );
+        return x;
+    }
+};
+
+}
@@ -0,0 +1,574 @@
+/*
+  Hashmap using hopscotch hashing, keeps HashMap's two cacheline guarantee at high load factors.
+  Copyright (C) 2018 Sio Kreuzer
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Same probe windows as HashMap (a key with home slot h is in the two cachelines starting at window_start( h )), but instead of doubling the table whenever a window is full:
+// -> every home slot has a neighbourhood bitmap (hops()), bit b set meaning slot window_start( home ) + b holds a key with that home
+//    -> lookups only compare the keys whose bits are set in their home's bitmap, and never look at anything outside the window
+// -> an insert takes the first free slot from the window start onwards (at most max_free_distance slots away); while that slot is outside the window, a key from an earlier slot whose window does contain it is moved there, moving the free slot closer
+//    -> only if there is no such key (or no free slot nearby) is the table doubled
+// -> the table has keys_per_cacheline slots more than length(), so windows of home slots in the last cacheline do not need to wrap around
+// -> removing a key just clears it's bit, nothing needs to be moved
+// CONSTRAINTS:
+// Key:
+//   -> 64 % sizeof( Key ) == 0 and sizeof( Key ) > 1 (currently not enforced by compiler)
+//   -> must be copy constructible
+//   -> is moved (or memcpy'd if is_trivially_relocatable) when displaced or when the table is resized
+//   -> must set aside an "empty"/"null" value
+// Value:
+//   -> must be copy constructible
+// Performance characteristics:
+//   -> get/rm: O(1), the keys within two cachelines (plus the home's bitmap)
+//   -> insert: O(1) average, O(max_free_distance) when displacing keys, O(n) when the table has to be doubled
+//   -> the table only doubles once the keys of some run of cachelines no longer fit into their windows, not as soon as one window is full
+//      -> with random 64 bit keys, it doubles at ~45% load at the lowest (HashMap: ~25%), 32 bit keys ~70% (HashMap: ~40%), 16 bit keys ~95% (HashMap: ~70%)
+//      -> the smaller the key, the more slots per window, the higher the load
+#pragma once
+
+#include <cassert>
+#include <cstring>
+#include <utility>
+#include <type_traits>
+
+#include "StaticHashMap.hpp"
+#include "IndexPolicy.hpp"
+#include "Allocator.hpp"
+#include "Optional.hpp"
+
+#include "utils.hpp"
+
+namespace LibSio
+{
+
+template< typename K, typename V
+        , size_t ( *_hash )( const K* const x ) = standard_hash< K >
+        , bool ( *eq )( const K* const a, const K* const b ) = standard_eq< K >
+        , typename Index = MaskIndex<> // lengths are powers of two, so any policy works
+        , typename Alloc = DefaultAllocator >
+struct HopscotchHashMap
+{
+    typedef HopscotchHashMap< K, V, _hash, eq, Index, Alloc > own_type;
+
+    static const size_t initial_length = 128;
+    static const size_t no_index = __SIZE_MAX__;
+    static const size_t keys_per_cacheline = 64 / sizeof( K );
+    static const size_t probe_limit = keys_per_cacheline * 2; // neighbourhood size, as in HashMap
+    static const size_t max_free_distance = 1024; // slots after the window start searched for a free slot before doubling the table instead
+    static const size_t reserve_load_percent = 90; // load factor reserve() sizes the table for
+    static const size_t get_many_batch = 16; // keys hashed and prefetched ahead of resolving them in get_many()
+
+    static_assert( probe_limit <= 64, "HopscotchHashMap: neighbourhood bitmaps have 64 bits at most" );
+
+    // smallest unsigned type with probe_limit bits
+    typedef typename std::conditional< probe_limit <= 16
+                                     , u16
+                                     , typename std::conditional< probe_limit <= 32, u32, u64 >::type
+                                     >::type hop_t;
+
+    // layout: keys, values (slots() of each), then the bitmaps (length of them)
+    byte* kvs;
+    size_t len;
+    size_t elements;
+    K empty_key;
+
+    static inline size_t slots_for( const size_t length )
+    {
+        return length + keys_per_cacheline;
+    }
+
+    static inline size_t hops_offset( const size_t length )
+    {
+        const size_t x = overall_arr_len_in_bytes< K, V >( slots_for( length ) );
+        return ( x + alignof( hop_t ) - 1 ) & ~( alignof( hop_t ) - 1 );
+    }
+
+    static inline size_t table_len_in_bytes( const size_t length )
+    {
+        return hops_offset( length ) + length * sizeof( hop_t );
+    }
+
+    inline size_t length()
+    {
+        return len;
+    }
+
+    inline size_t slots()
+    {
+        return slots_for( len );
+    }
+
+    inline K* keys()
+    {
+        return ( K* ) kvs;
+    }
+
+    inline V* values()
+    {
+        return ( V* ) ( kvs + key_arr_len_in_bytes< K, V >( slots() ) );
+    }
+
+    inline hop_t* hops()
+    {
+        return ( hop_t* ) ( kvs + hops_offset( len ) );
+    }
+
+    inline bool is_full( const size_t i )
+    {
+        return !eq( keys() + i, &empty_key );
+    }
+
+    static inline size_t hash_full( const K* const k )
+    {
+        return Index::mix( _hash( k ) );
+    }
+
+    // first slot of the neighbourhood of a given home slot
+    static inline size_t window_start( const size_t home )
+    {
+        return home & ~( keys_per_cacheline - 1 );
+    }
+
+    inline void alloc_table()
+    {
+        kvs = ( byte* ) Alloc::alloc( table_len_in_bytes( len ), 64 );
+        assert( kvs );
+        for ( size_t i = 0; i < slots(); i++ ) {
+            new( keys() + i ) K( empty_key );
+        }
+        memset( hops(), 0, len * sizeof( hop_t ) );
+    }
+
+    inline void destroy_table()
+    {
+        if ( !kvs ) {
+            return;
+        }
+        for ( size_t i = 0; i < slots(); i++ ) {
+            if ( is_full( i ) ) {
+                callDestructorIfExistent< V >( values() + i );
+            }
+            callDestructorIfExistent< K >( keys() + i );
+        }
+        Alloc::dealloc( kvs, table_len_in_bytes( len ) );
+        kvs = nullptr;
+    }
+
+    // index of a key with mixed hash hashed that matches( key ) is true for, no_index if there is none
+    template< typename M >
+    size_t find( const size_t hashed, M matches )
+    {
+        const size_t home = Index::index( hashed, len );
+        const size_t start = window_start( home );
+        for ( hop_t bits = hops()[home]; bits; bits &= bits - 1 ) {
+            const size_t i = start + __builtin_ctzll( bits );
+            if ( matches( keys() + i ) ) {
+                return i;
+            }
+        }
+        return no_index;
+    }
+
+    // moves the key/value at src into the slot dst, which holds the empty key. Leaves the empty key at src.
+    inline void move_slot( const size_t dst, const size_t src )
+    {
+        callDestructorIfExistent< K >( keys() + dst );
+        relocate< K >( keys() + dst, keys() + src );
+        relocate< V >( values() + dst, values() + src );
+        new( keys() + src ) K( empty_key );
+    }
+
+    // a free slot within the window of home (with it's bit already set), moving other keys around if necessary. no_index if there is none.
+    size_t make_room( const size_t home )
+    {
+        const size_t start = window_start( home );
+        const size_t end = start + max_free_distance < slots() ? start + max_free_distance : slots();
+        size_t f = start;
+        for ( ; f < end && is_full( f ); f++ );
+        if ( f == end ) {
+            return no_index;
+        }
+        // hop the free slot backwards until it is within the window
+        while ( f >= start + probe_limit ) {
+            bool moved = false;
+            // homes whose windows contain f, earliest window first (moves the free slot the farthest)
+            const size_t first_home = window_start( f + keys_per_cacheline - probe_limit );
+            for ( size_t h = first_home; h <= f && h < len && !moved; h++ ) {
+                const size_t hs = window_start( h );
+                const hop_t before_f = ( hop_t ) ( hops()[h] & ( ( ( ( u64 ) 1 ) << ( f - hs ) ) - 1 ) );
+                if ( before_f ) {
+                    const size_t b = __builtin_ctzll( before_f );
+                    move_slot( f, hs + b );
+                    hops()[h] = ( hop_t ) ( ( hops()[h] & ~( ( ( hop_t ) 1 ) << b ) ) | ( ( hop_t ) ( ( ( u64 ) 1 ) << ( f - hs ) ) ) );
+                    f = hs + b;
+                    moved = true;
+                }
+            }
+            if ( !moved ) {
+                return no_index;
+            }
+        }
+        hops()[home] |= ( hop_t ) ( ( ( u64 ) 1 ) << ( f - start ) );
+        return f;
+    }
+
+    // a slot for a new key with mixed hash hashed (empty key destroyed, bit set), doubling the table until there is one
+    size_t slot_for_new( const size_t hashed )
+    {
+        while ( true ) {
+            const size_t n = make_room( Index::index( hashed, len ) );
+            if ( n != no_index ) {
+                callDestructorIfExistent< K >( keys() + n );
+                return n;
+            }
+            resize_to( len * 2 );
+        }
+    }
+
+    void resize_to( const size_t length )
+    {
+        own_type x( empty_key, length, false );
+        for ( size_t i = 0; i < slots(); i++ ) {
+            if ( is_full( i ) ) {
+                const size_t n = x.slot_for_new( hash_full( keys() + i ) );
+                relocate< K >( x.keys() + n, keys() + i );
+                relocate< V >( x.values() + n, values() + i );
+            } else {
+                callDestructorIfExistent< K >( keys() + i );
+            }
+        }
+        Alloc::dealloc( kvs, table_len_in_bytes( len ) );
+        kvs = x.kvs;
+        len = x.len;
+        x.kvs = nullptr;
+    }
+
+  private:
+    HopscotchHashMap( K _empty_key, const size_t length, __attribute__((unused)) const bool sized )
+        : kvs( nullptr )
+        , len( length )
+        , elements( 0 )
+        , empty_key( _empty_key )
+    {
+        alloc_table();
+    }
+
+  public:
+    HopscotchHashMap() = delete;
+
+    HopscotchHashMap( K _empty_key )
+        : HopscotchHashMap( _empty_key, initial_length, true )
+    {}
+
+    // bulk construction: sized for all count elements up front (if a key appears more than once, the first one wins)
+    HopscotchHashMap( K _empty_key, const K* const keys, const V* const values, const size_t count )
+        : HopscotchHashMap( _empty_key )
+    {
+        reserve( count );
+        for ( size_t i = 0; i < count; i++ ) {
+            emplace( keys[i], values[i] );
+        }
+    }
+
+    // copies slot for slot, so nothing needs to be rehashed
+    HopscotchHashMap( HopscotchHashMap& x )
+        : HopscotchHashMap( x.empty_key, x.len, true )
+    {
+        for ( size_t i = 0; i < slots(); i++ ) {
+            if ( x.is_full( i ) ) {
+                callDestructorIfExistent< K >( keys() + i );
+                new( keys() + i ) K( x.keys()[i] );
+                new( values() + i ) V( x.values()[i] );
+            }
+        }
+        memcpy( hops(), x.hops(), len * sizeof( hop_t ) );
+        elements = x.elements;
+    }
+
+    ~HopscotchHashMap()
+    {
+        destroy_table();
+    }
+
+    HopscotchHashMap& operator=( HopscotchHashMap& x )
+    {
+        this -> ~HopscotchHashMap();
+        new( this ) own_type( x );
+        return *this;
+    }
+
+    // makes sure the table is large enough for n elements in total (assuming a load factor of reserve_load_percent), only ever grows the table
+    void reserve( const size_t n )
+    {
+        size_t length = len;
+        while ( length * reserve_load_percent < n * 100 ) {
+            length *= 2;
+        }
+        if ( length > len ) {
+            resize_to( length );
+        }
+    }
+
+    // get_ref for a key with mixed hash hashed that matches( key ) is true for
+    template< typename M >
+    V* get_ref_with( const size_t hashed, M matches )
+    {
+        const size_t i = find( hashed, matches );
+        return i != no_index ? values() + i : nullptr;
+    }
+
+    V* get_ref( const K& k )
+    {
+        return get_ref_with(
+            hash_full( &k )
+          , [&]
+            ( const K* const x )
+            -> bool
+            {
+                return eq( x, &k );
+            }
+        );
+    }
+
+    Optional< V > get( const K& k )
+    {
+        V* x = get_ref( k );
+        if ( x ) {
+            return Just< V >( *x );
+        } else {
+            return Nothing< V >();
+        }
+    }
+
+    // get_ref for n keys at once: out[i] = get_ref( ks[i] )
+    // hashes a batch of keys and prefetches their bitmaps and windows before resolving any of them, so the cache misses overlap
+    void get_many( const K* const ks, const size_t n, V** const out )
+    {
+        size_t hashed[get_many_batch];
+        for ( size_t b = 0; b < n; b += get_many_batch ) {
+            const size_t batch = n - b < get_many_batch ? n - b : get_many_batch;
+            for ( size_t j = 0; j < batch; j++ ) {
+                hashed[j] = hash_full( ks + b + j );
+                const size_t home = Index::index( hashed[j], len );
+                __builtin_prefetch( hops() + home );
+                __builtin_prefetch( keys() + window_start( home ) );
+                __builtin_prefetch( keys() + window_start( home ) + keys_per_cacheline );
+            }
+            for ( size_t j = 0; j < batch; j++ ) {
+                const K* const k = ks + b + j;
+                out[b + j] = get_ref_with(
+                    hashed[j]
+                  , [=]
+                    ( const K* const x )
+                    -> bool
+                    {
+                        return eq( x, k );
+                    }
+                );
+            }
+        }
+    }
+
+    // lookup_key< K, Q > for Q's the map may be searched by (see get_ref( const Q& ))
+    template< typename Q >
+    using lookup_for = typename std::enable_if< detail::heterogeneous_lookup< K, typename std::decay< Q >::type, _hash >::value
+                                              , detail::heterogeneous_lookup< K, typename std::decay< Q >::type, _hash >
+                                              >::type;
+
+    // get_ref/get/rm without constructing a K, e.g. by a const char* or std::string_view for String keys (see lookup_key in utils.hpp)
+    template< typename Q, typename L = lookup_for< Q > >
+    V* get_ref( const Q& q )
+    {
+        return get_ref_with(
+            Index::mix( L::hash( q ) )
+          , [&]
+            ( const K* const x )
+            -> bool
+            {
+                return L::eq( x, q );
+            }
+        );
+    }
+
+    template< typename Q, typename L = lookup_for< Q > >
+    Optional< V > get( const Q& q )
+    {
+        V* x = get_ref( q );
+        if ( x ) {
+            return Just< V >( *x );
+        } else {
+            return Nothing< V >();
+        }
+    }
+
+    template< typename Q, typename L = lookup_for< Q > >
+    void rm( const Q& q )
+    {
+        rm_with(
+            Index::mix( L::hash( q ) )
+          , [&]
+            ( const K* const x )
+            -> bool
+            {
+                return L::eq( x, q );
+            }
+        );
+    }
+
+    bool insert( const K& k, V& v )
+    {
+        return emplace( k, v );
+    }
+
+    // returns true on success, false if key already in map
+    template< typename... Args >
+    bool emplace( const K& k, Args... args )
+    {
+        if ( eq( &empty_key, &k ) ) {
+            return false; // attempting to insert empty key
+        }
+        return emplace_hashed( hash_full( &k ), k, args... );
+    }
+
+    // emplace with the mixed hash of k already computed
+    template< typename... Args >
+    bool emplace_hashed( const size_t hashed, const K& k, Args... args )
+    {
+        const size_t found = find(
+            hashed
+          , [&]
+            ( const K* const x )
+            -> bool
+            {
+                return eq( x, &k );
+            }
+        );
+        if ( found != no_index ) {
+            return false; // key already in map
+        }
+        const size_t n = slot_for_new( hashed );
+        new( keys() + n ) K( k );
+        new( values() + n ) V( args... );
+        elements++;
+        return true;
+    }
+
+    void rm( const K& k )
+    {
+        rm_with(
+            hash_full( &k )
+          , [&]
+            ( const K* const x )
+            -> bool
+            {
+                return eq( x, &k );
+            }
+        );
+    }
+
+    // rm for a key with mixed hash hashed that matches( key ) is true for
+    template< typename M >
+    void rm_with( const size_t hashed, M matches )
+    {
+        const size_t i = find( hashed, matches );
+        if ( i == no_index ) {
+            return;
+        }
+        const size_t home = Index::index( hashed, len );
+        hops()[home] = ( hop_t ) ( hops()[home] & ~( ( hop_t ) ( ( ( u64 ) 1 ) << ( i - window_start( home ) ) ) ) );
+        callDestructorIfExistent< K >( keys() + i );
+        callDestructorIfExistent< V >( values() + i );
+        new( keys() + i ) K( empty_key );
+        elements--;
+    }
+
+    void clear()
+    {
+        for ( size_t i = 0; i < slots(); i++ ) {
+            if ( is_full( i ) ) {
+                callDestructorIfExistent< K >( keys() + i );
+                callDestructorIfExistent< V >( values() + i );
+                new( keys() + i ) K( empty_key );
+            }
+        }
+        memset( hops(), 0, len * sizeof( hop_t ) );
+        elements = 0;
+    }
+
+    template< typename F >
+    inline void foreach_cell( F fn )
+    {
+        for ( size_t i = 0; i < slots(); i++ ) {
+            if ( is_full( i ) ) {
+                fn( ( const K* ) keys() + i, values() + i );
+            }
+        }
+    }
+
+    void foreach_value( void ( *fn )( V* value ) )
+    {
+        foreach_value_lambda( fn );
+    }
+
+    template< typename F >
+    void foreach_value_lambda( F fn )
+    {
+        foreach_cell(
+            [&]
+            ( __attribute__((unused)) const K* _, V* v )
+            -> void
+            {
+                fn( v );
+            }
+        );
+    }
+
+    void foreach( void ( *fn )( const K* key, V* value ) )
+    {
+        foreach_cell( fn );
+    }
+
+    template< typename F >
+    void foreach_lambda( F fn )
+    {
+        foreach_cell( fn );
+    }
+
+    // foreach/foreach_value for any callable (lambdas with captures, function objects), which unlike std::function can be inlined
+    template< typename F >
+    void foreach( F fn )
+    {
+        foreach_lambda( fn );
+    }
+
+    template< typename F >
+    void foreach_value( F fn )
+    {
+        foreach_value_lambda( fn );
+    }
+
+    // count of elements in container, O(1)
+    size_t count()
+    {
+        return elements;
+    }
+
+    bool empty()
+    {
+        return elements == 0;
+    }
+};
+
+}
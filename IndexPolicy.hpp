@@ -0,0 +1,172 @@
+/*
+  Hash mixing and index reduction policies for the hashmaps in this library.
+  Copyright (C) 2018 Sio Kreuzer
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// An index policy turns the result of the primary hash function into a position in a table of a given length, in two steps:
+// -> mix( hash ): improves the distribution of a bad primary hash function (std::hash on integers is typically the identity function). The result is what gets stored/compared as "the hash" of a key.
+// -> index( mixed, length ): reduces the mixed hash to \{ 0 ... length - 1 \}
+// needs_power_of_two_length is true if index() only works on tables whose length is a power of two.
+// mix() and index() are constexpr, so tables can be laid out at compile time (see ConstexprHashMap.hpp).
+//
+// Mixers:
+// -> FibonacciMix: multiplication by 2^64 / golden ratio (the hash_secondary of old). Cheap, but only carries entropy upwards.
+// -> Murmur3Mix: murmur3 finalizer. Every input bit affects every output bit, costs a few more multiplications.
+// -> IdentityMix: for primary hash functions that are already good.
+//
+// Reductions:
+// -> ModuloIndex: mixed % length. Any length, costs an integer division.
+// -> MaskIndex: low bits of the mixed hash. Power of two lengths only, throws away the high bits (which are the good ones for FibonacciMix).
+// -> ShiftIndex: high bits of the mixed hash ("proper" fibonacci hashing when used with FibonacciMix). Power of two lengths only.
+// -> FastRangeIndex: Lemire's multiply-shift range reduction ( mixed * length ) >> 64. Any length, uses the high bits.
+// -> PrimeModuloIndex: mixed % a prime. Any length, but length should be prime for anything that isn't a power of two - for power of two lengths, the largest prime below the length is used (so the last few slots are only reached by probing). Slowest, most forgiving of a weak mixer.
+#pragma once
+
+#include <cstddef>
+
+#include "utils.hpp"
+
+namespace LibSio
+{
+
+struct FibonacciMix
+{
+    static constexpr size_t mix( const size_t h )
+    {
+        const size_t hash_multiplier = 11400714819323198485LU; // derived from golden ratio, not ideal - repeated patterns in form of fibonacci sequence
+        return h * hash_multiplier;
+    }
+};
+
+struct Murmur3Mix
+{
+    static constexpr size_t mix( size_t h )
+    {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdLU;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53LU;
+        h ^= h >> 33;
+        return h;
+    }
+};
+
+struct IdentityMix
+{
+    static constexpr size_t mix( const size_t h )
+    {
+        return h;
+    }
+};
+
+template< typename Mix = FibonacciMix >
+struct ModuloIndex
+{
+    static const bool needs_power_of_two_length = false;
+
+    static constexpr size_t mix( const size_t h )
+    {
+        return Mix::mix( h );
+    }
+
+    static constexpr size_t index( const size_t mixed, const size_t length )
+    {
+        return mixed % length;
+    }
+};
+
+template< typename Mix = FibonacciMix >
+struct MaskIndex
+{
+    static const bool needs_power_of_two_length = true;
+
+    static constexpr size_t mix( const size_t h )
+    {
+        return Mix::mix( h );
+    }
+
+    static constexpr size_t index( const size_t mixed, const size_t length )
+    {
+        return mixed & ( length - 1 );
+    }
+};
+
+template< typename Mix = FibonacciMix >
+struct ShiftIndex
+{
+    static const bool needs_power_of_two_length = true;
+
+    static constexpr size_t mix( const size_t h )
+    {
+        return Mix::mix( h );
+    }
+
+    static constexpr size_t index( const size_t mixed, const size_t length )
+    {
+        // shifting in two steps, as a shift by 64 (length == 1) is undefined
+        return ( mixed >> 1 ) >> ( 63 - __builtin_ctzll( length ) );
+    }
+};
+
+template< typename Mix = FibonacciMix >
+struct FastRangeIndex
+{
+    static const bool needs_power_of_two_length = false;
+
+    static constexpr size_t mix( const size_t h )
+    {
+        return Mix::mix( h );
+    }
+
+    static constexpr size_t index( const size_t mixed, const size_t length )
+    {
+        return ( size_t ) ( ( ( unsigned __int128 ) mixed * length ) >> 64 );
+    }
+};
+
+template< typename Mix = FibonacciMix >
+struct PrimeModuloIndex
+{
+    static const bool needs_power_of_two_length = false;
+
+    // largest prime <= 2^n (1 for n = 0)
+    static constexpr const size_t largest_prime_below_power_of_two[64] = {
+        1ull, 2ull, 3ull, 7ull, 13ull, 31ull, 61ull, 127ull, 251ull, 509ull, 1021ull, 2039ull, 4093ull, 8191ull, 16381ull, 32749ull
+      , 65521ull, 131071ull, 262139ull, 524287ull, 1048573ull, 2097143ull, 4194301ull, 8388593ull, 16777213ull, 33554393ull
+      , 67108859ull, 134217689ull, 268435399ull, 536870909ull, 1073741789ull, 2147483647ull, 4294967291ull, 8589934583ull
+      , 17179869143ull, 34359738337ull, 68719476731ull, 137438953447ull, 274877906899ull, 549755813881ull, 1099511627689ull
+      , 2199023255531ull, 4398046511093ull, 8796093022151ull, 17592186044399ull, 35184372088777ull, 70368744177643ull
+      , 140737488355213ull, 281474976710597ull, 562949953421231ull, 1125899906842597ull, 2251799813685119ull
+      , 4503599627370449ull, 9007199254740881ull, 18014398509481951ull, 36028797018963913ull, 72057594037927931ull
+      , 144115188075855859ull, 288230376151711717ull, 576460752303423433ull, 1152921504606846883ull
+      , 2305843009213693951ull, 4611686018427387847ull, 9223372036854775783ull
+    };
+
+    static constexpr size_t mix( const size_t h )
+    {
+        return Mix::mix( h );
+    }
+
+    static constexpr size_t index( const size_t mixed, const size_t length )
+    {
+        if ( ( length & ( length - 1 ) ) == 0 ) {
+            return mixed % largest_prime_below_power_of_two[__builtin_ctzll( length )];
+        } else {
+            return mixed % length;
+        }
+    }
+};
+
+}
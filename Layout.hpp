@@ -0,0 +1,163 @@
+/*
+  Key/value layout policies for the hashmaps in this library.
+  Copyright (C) 2018 Sio Kreuzer
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// A layout policy places the keys and values of a table of length slots within one array:
+// -> arr_len_in_bytes( length ): size of the array
+// -> key_offset( length, i ), value_offset( length, i ): where the key/value of slot i are, in bytes from the start of the array (which is 64 byte aligned)
+// -> slots_per_bucket: 0 for SplitLayout, the number of slots per cacheline for InterleavedLayout (so it can be told apart in images, see MappedStaticHashMap.hpp)
+//
+// Layouts:
+// -> SplitLayout: all keys, then all values. Keys are packed as densely as possible (more keys per probed cacheline), but a hit costs one cache miss for the key and another one for the value.
+// -> InterleavedLayout: cacheline sized and aligned buckets, each holding slots_per_bucket keys followed by their values. A hit costs a single cache miss, probes see fewer keys per cacheline.
+// -> AutoLayout: InterleavedLayout if a key and it's value take up at most interleave_max_bytes together (u32 -> u32, u64 -> pointer, ...), SplitLayout otherwise (where a value alone would take up a good part of a bucket). Has to be asked for: the maps default to SplitLayout (HashMap's two cacheline guarantee is stated for it).
+// -> KeysOnlyLayout: for sets (see StaticHashSet.hpp, HashSet.hpp), whose values are an empty type: only keys, the values of all slots share a single byte after them.
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+
+#include "utils.hpp"
+
+namespace LibSio
+{
+
+template< typename K, typename V >
+inline size_t key_arr_len_in_bytes( size_t length )
+{
+    return ( length * sizeof( K ) )
+         + ( ( length * sizeof( K ) ) % alignof( V ) );
+}
+
+template< typename K, typename V >
+inline size_t overall_arr_len_in_bytes( size_t length )
+{
+    return key_arr_len_in_bytes< K, V >( length ) + ( length * sizeof( V ) );
+}
+
+template< typename K, typename V >
+struct SplitLayout
+{
+    static const size_t slots_per_bucket = 0;
+
+    static inline size_t arr_len_in_bytes( const size_t length )
+    {
+        return overall_arr_len_in_bytes< K, V >( length );
+    }
+
+    static inline size_t key_offset( __attribute__((unused)) const size_t length, const size_t i )
+    {
+        return i * sizeof( K );
+    }
+
+    static inline size_t value_offset( const size_t length, const size_t i )
+    {
+        return key_arr_len_in_bytes< K, V >( length ) + i * sizeof( V );
+    }
+};
+
+namespace detail
+{
+
+template< typename K, typename V >
+constexpr size_t bucket_values_offset( const size_t n )
+{
+    return ( n * sizeof( K ) + alignof( V ) - 1 ) & ~( alignof( V ) - 1 );
+}
+
+// most slots whose keys, padding and values fit into a cacheline
+template< typename K, typename V >
+constexpr size_t bucket_slots()
+{
+    size_t n = 64 / ( sizeof( K ) + sizeof( V ) );
+    while ( n > 1 && bucket_values_offset< K, V >( n ) + n * sizeof( V ) > 64 ) {
+        n--;
+    }
+    return n;
+}
+
+}
+
+template< typename K, typename V >
+struct InterleavedLayout
+{
+    static const size_t slots_per_bucket = detail::bucket_slots< K, V >();
+    static const size_t bucket_bytes = 64;
+    static const size_t values_offset = detail::bucket_values_offset< K, V >( slots_per_bucket );
+
+    static_assert( slots_per_bucket > 0 && values_offset + slots_per_bucket * sizeof( V ) <= bucket_bytes
+                 , "InterleavedLayout: a key and it's value have to fit into a cacheline"
+                 );
+    static_assert( alignof( K ) <= bucket_bytes && alignof( V ) <= bucket_bytes, "InterleavedLayout: keys and values may at most be cacheline aligned" );
+
+    static inline size_t arr_len_in_bytes( const size_t length )
+    {
+        return ( ( length + slots_per_bucket - 1 ) / slots_per_bucket ) * bucket_bytes;
+    }
+
+    // slots_per_bucket is a constant, so these divisions compile to multiplications (or shifts)
+    static inline size_t key_offset( __attribute__((unused)) const size_t length, const size_t i )
+    {
+        return ( i / slots_per_bucket ) * bucket_bytes + ( i % slots_per_bucket ) * sizeof( K );
+    }
+
+    static inline size_t value_offset( __attribute__((unused)) const size_t length, const size_t i )
+    {
+        return ( i / slots_per_bucket ) * bucket_bytes + values_offset + ( i % slots_per_bucket ) * sizeof( V );
+    }
+};
+
+namespace detail
+{
+
+// value type of sets, has no state and thus needs no storage of it's own
+struct SetValue
+{};
+
+}
+
+template< typename K, typename V = detail::SetValue >
+struct KeysOnlyLayout
+{
+    static_assert( std::is_empty< V >::value && std::is_trivially_copyable< V >::value, "KeysOnlyLayout: values must be of a stateless type" );
+
+    static const size_t slots_per_bucket = 0;
+
+    static inline size_t arr_len_in_bytes( const size_t length )
+    {
+        return length * sizeof( K ) + sizeof( V );
+    }
+
+    static inline size_t key_offset( __attribute__((unused)) const size_t length, const size_t i )
+    {
+        return i * sizeof( K );
+    }
+
+    static inline size_t value_offset( const size_t length, __attribute__((unused)) const size_t i )
+    {
+        return length * sizeof( K );
+    }
+};
+
+static const size_t interleave_max_bytes = 16;
+
+template< typename K, typename V >
+using AutoLayout = typename std::conditional< sizeof( K ) + sizeof( V ) <= interleave_max_bytes
+                                            , InterleavedLayout< K, V >
+                                            , SplitLayout< K, V >
+                                            >::type;
+
+}
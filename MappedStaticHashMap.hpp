@@ -0,0 +1,318 @@
+/*
+  Read-only StaticHashMap backed by a memory-mapped file.
+  Copyright (C) 2018 Sio Kreuzer
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// For StaticHashMaps that are built once and then loaded by every process start: write_image() dumps a built map into a file, MappedStaticHashMap maps that file read-only and searches it in place.
+// -> loading is a single mmap, independent of the size of the table: nothing is parsed or copied, pages get faulted in as lookups touch them
+// -> processes mapping the same file share it's pages in the page cache
+// -> K and V must be trivially copyable and must not contain pointers (store offsets into some other mapped array instead), as they are stored and used as they are in memory
+// -> the hash function and Index policy must be the same as the ones the image was written with. An image is rejected if the empty key does not hash to the position it did when it was written, which catches most (but not all) mismatches.
+// Image layout (native endianness, so images are only portable between machines of the same architecture):
+// -> image_header (magic, format version, sizes and alignments of K and V, length, offset/size of the array)
+// -> the empty key
+// -> padding up to image_kvs_offset
+// -> the array of the map, byte for byte (keys and values as placed by Layout, see Layout.hpp; an image is rejected if it was written with another layout)
+#pragma once
+
+#include <cstring>
+#include <cstdio>
+#include <cassert>
+#include <string>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "StaticHashMap.hpp"
+#include "Optional.hpp"
+
+#include "utils.hpp"
+
+namespace LibSio
+{
+
+namespace detail
+{
+
+struct image_header
+{
+    char magic[8]; // image_magic
+    u32 version; // image_version
+    u32 header_bytes; // sizeof( image_header )
+    u64 key_size;
+    u64 key_align;
+    u64 value_size;
+    u64 value_align;
+    u64 length;
+    u64 kvs_offset;
+    u64 kvs_bytes;
+    u64 slots_per_bucket; // Layout::slots_per_bucket, 0 for SplitLayout
+    u64 empty_key_index; // Index::index( Index::mix( _hash( empty key ) ), length ) when the image was written
+};
+
+static const char image_magic[8] = { 'L', 'i', 'b', 'S', 'i', 'o', 'S', 'M' };
+static const u32 image_version = 2;
+static const size_t image_kvs_offset = 4096; // one page, so the array starts out page aligned (and 64 byte aligned in any case)
+
+}
+
+template< typename K
+        , typename V
+        , size_t ( *_hash )( const K* const x ) = standard_hash< K >
+        , bool ( *eq )( const K* const a, const K* const b ) = standard_eq< K >
+        , typename Index = ModuloIndex<>
+        , typename Layout = SplitLayout< K, V >
+        >
+struct MappedStaticHashMap
+{
+    typedef MappedStaticHashMap< K, V, _hash, eq, Index, Layout > own_type;
+
+    static_assert( std::is_trivially_copyable< K >::value && std::is_trivially_copyable< V >::value
+                 , "MappedStaticHashMap: keys and values are used straight from the file, they must be trivially copyable"
+                 );
+    static_assert( sizeof( detail::image_header ) + sizeof( K ) <= detail::image_kvs_offset
+                 , "MappedStaticHashMap: empty key does not fit in front of the array"
+                 );
+
+    constexpr static const size_t no_index = __SIZE_MAX__;
+
+    const byte* image; // the whole mapping, null if mapping the file failed or it was not a valid image
+    size_t image_bytes;
+    const byte* kvs;
+    size_t length;
+    const K* empty_key;
+
+    const K* key( const size_t i ) const
+    {
+        return ( const K* ) ( kvs + Layout::key_offset( length, i ) );
+    }
+
+    const V* value( const size_t i ) const
+    {
+        return ( const V* ) ( kvs + Layout::value_offset( length, i ) );
+    }
+
+    // writes m into an image at path: into path.tmp first, which is then renamed to path, so processes still mapping an older image at path keep seeing the old one
+    // works with a StaticHashMap using any Alloc. Returns false on failure (nothing is left at path.tmp).
+    template< typename Alloc >
+    static bool write_image( StaticHashMap< K, V, _hash, eq, Index, Alloc, Layout >& m, const char* const path )
+    {
+        byte head[detail::image_kvs_offset];
+        memset( head, 0, sizeof( head ) );
+
+        detail::image_header h;
+        memcpy( h.magic, detail::image_magic, sizeof( h.magic ) );
+        h.version = detail::image_version;
+        h.header_bytes = sizeof( detail::image_header );
+        h.key_size = sizeof( K );
+        h.key_align = alignof( K );
+        h.value_size = sizeof( V );
+        h.value_align = alignof( V );
+        h.length = m.length;
+        h.kvs_offset = detail::image_kvs_offset;
+        h.kvs_bytes = m.overall_arr_len_in_bytes();
+        h.slots_per_bucket = Layout::slots_per_bucket;
+        h.empty_key_index = Index::index( Index::mix( _hash( &( m.empty_key ) ) ), m.length );
+        memcpy( head, &h, sizeof( h ) );
+        memcpy( head + empty_key_offset(), &( m.empty_key ), sizeof( K ) );
+
+        const std::string tmp = std::string( path ) + ".tmp";
+        FILE* const f = fopen( tmp.c_str(), "wb" );
+        if ( !f ) {
+            return false;
+        }
+        const bool written = fwrite( head, 1, sizeof( head ), f ) == sizeof( head )
+                          && fwrite( m.kvs, 1, h.kvs_bytes, f ) == h.kvs_bytes;
+        const bool closed = fclose( f ) == 0;
+        if ( !written || !closed || rename( tmp.c_str(), path ) != 0 ) {
+            remove( tmp.c_str() );
+            return false;
+        }
+        return true;
+    }
+
+    static inline size_t empty_key_offset()
+    {
+        return ( sizeof( detail::image_header ) + alignof( K ) - 1 ) & ~( alignof( K ) - 1 );
+    }
+
+    MappedStaticHashMap() = delete;
+
+    MappedStaticHashMap( const own_type& ) = delete;
+
+    // maps the image at path, check valid() afterwards
+    MappedStaticHashMap( const char* const path )
+        : image( nullptr )
+        , image_bytes( 0 )
+        , kvs( nullptr )
+        , length( 0 )
+        , empty_key( nullptr )
+    {
+        const int fd = open( path, O_RDONLY | O_CLOEXEC );
+        if ( fd < 0 ) {
+            return;
+        }
+        struct stat st;
+        if ( fstat( fd, &st ) != 0 || ( size_t ) st.st_size < detail::image_kvs_offset ) {
+            close( fd );
+            return;
+        }
+        void* const x = mmap( nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+        close( fd ); // the mapping keeps the file alive
+        if ( x == MAP_FAILED ) {
+            return;
+        }
+        image = ( const byte* ) x;
+        image_bytes = st.st_size;
+
+        detail::image_header h;
+        memcpy( &h, image, sizeof( h ) );
+        if ( memcmp( h.magic, detail::image_magic, sizeof( h.magic ) ) != 0
+          || h.version != detail::image_version
+          || h.header_bytes != sizeof( detail::image_header )
+          || h.key_size != sizeof( K ) || h.key_align != alignof( K )
+          || h.value_size != sizeof( V ) || h.value_align != alignof( V )
+          || h.length == 0
+          || h.kvs_offset != detail::image_kvs_offset
+          || h.kvs_bytes != Layout::arr_len_in_bytes( h.length )
+          || h.slots_per_bucket != Layout::slots_per_bucket
+          || h.kvs_offset + h.kvs_bytes != image_bytes
+          || ( Index::needs_power_of_two_length && ( h.length & ( h.length - 1 ) ) != 0 ) ) {
+            unmap();
+            return;
+        }
+        length = h.length;
+        kvs = image + h.kvs_offset;
+        empty_key = ( const K* ) ( image + empty_key_offset() );
+        if ( Index::index( Index::mix( _hash( empty_key ) ), length ) != h.empty_key_index ) {
+            unmap(); // written with a different hash function or Index policy
+            return;
+        }
+    }
+
+    MappedStaticHashMap( own_type&& x )
+        : image( x.image )
+        , image_bytes( x.image_bytes )
+        , kvs( x.kvs )
+        , length( x.length )
+        , empty_key( x.empty_key )
+    {
+        x.image = nullptr;
+        x.kvs = nullptr;
+    }
+
+    ~MappedStaticHashMap()
+    {
+        unmap();
+    }
+
+    void unmap()
+    {
+        if ( image ) {
+            munmap( ( void* ) image, image_bytes );
+        }
+        image = nullptr;
+        kvs = nullptr;
+        length = 0;
+        empty_key = nullptr;
+    }
+
+    // false if the file could not be mapped or is not an image of a map with these K, V, hash function and Index policy
+    bool valid() const
+    {
+        return kvs != nullptr;
+    }
+
+    // same probing as StaticHashMap::get_index_for_key
+    size_t get_index_for_key( const K* const k ) const
+    {
+        if ( !valid() ) {
+            return no_index;
+        }
+        const size_t hashed = Index::index( Index::mix( _hash( k ) ), length );
+        for ( size_t i = 0; i < length; i++ ) {
+            const size_t index = hashed + i < length ? hashed + i : hashed + i - length;
+            if ( eq( key( index ), k ) ) {
+                return index;
+            }
+        }
+        return no_index;
+    }
+
+    // pointers stay valid for as long as the map is mapped
+    const V* get_ref( const K& k ) const
+    {
+        auto index = get_index_for_key( &k );
+        if ( index != no_index ) {
+            return value( index );
+        } else {
+            return nullptr;
+        }
+    }
+
+    Optional< V > get( const K& k ) const
+    {
+        auto el = get_ref( k );
+        if ( el ) {
+            V v = *el;
+            return Just< V >( v );
+        } else {
+            return Nothing< V >();
+        }
+    }
+
+    template< typename F >
+    void foreach_lambda( F fn ) const
+    {
+        for ( size_t i = 0; i < length; i++ ) {
+            if ( !eq( key( i ), empty_key ) ) {
+                fn( key( i ), value( i ) );
+            }
+        }
+    }
+
+    template< typename F >
+    void foreach_value_lambda( F fn ) const
+    {
+        foreach_lambda(
+            [&]
+            ( __attribute__((unused)) const K* _, const V* v )
+            -> void
+            {
+                fn( v );
+            }
+        );
+    }
+
+    // count of elements in container
+    size_t count() const
+    {
+        size_t n = 0;
+        foreach_lambda(
+            [&]
+            ( __attribute__((unused)) const K* _k, __attribute__((unused)) const V* _v )
+            -> void
+            {
+                n++;
+            }
+        );
+        return n;
+    }
+};
+
+}
@@ -19,6 +19,7 @@
 
 #include <cstring>
 #include <functional>
+#include <utility>
 
 #include "utils.hpp"
 
@@ -45,7 +46,7 @@ struct Optional
     Optional( Args... args )
         : is_just( true )
     {
-        ( ( T* ) just ) -> T( args... );
+        new( just ) T( args... );
     }
 
     ~Optional()
@@ -80,6 +81,17 @@ struct Optional
         }
     }
 
+    // monadic bind for any callable returning an Optional (lambdas, function objects), which unlike std::function can be inlined
+    template< typename F, typename R = decltype( std::declval< F& >()( std::declval< T& >() ) ) >
+    R operator>>=( F fn )
+    {
+        if ( is_just ) {
+            return fn( *( ( T* ) just ) );
+        } else {
+            return R();
+        }
+    }
+
     // map function
     template< typename U >
     Optional< U > fmap( std::function< U( T ) > fn )
@@ -90,6 +102,17 @@ struct Optional
             return Optional< U >();
         }
     }
+
+    // fmap for any callable, see operator>>=
+    template< typename F, typename U = decltype( std::declval< F& >()( std::declval< T& >() ) ) >
+    Optional< U > fmap( F fn )
+    {
+        if ( is_just ) {
+            return Optional< U >( fn( *( ( T* ) just ) ) );
+        } else {
+            return Optional< U >();
+        }
+    }
 };
 
 template< typename T >
@@ -0,0 +1,95 @@
+/*
+  Splitting slot ranges of the hashmaps in this library across threads.
+  Copyright (C) 2018 Sio Kreuzer
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Used by the parallel_foreach/parallel_foreach_value/parallel_reduce members of the hashmaps.
+// The slot range is cut into chunks whose boundaries are multiples of a cacheline's worth of slots (so no two threads write to the same cacheline of keys), which the worker threads then take from a shared counter one at a time.
+// Workers are started per call and joined before returning; the calling thread is worker 0.
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cstddef>
+
+#include "utils.hpp"
+
+namespace LibSio
+{
+
+namespace detail
+{
+
+static const size_t parallel_chunks_per_thread = 8; // more chunks than threads, so threads finishing early can help out with the rest
+
+inline size_t parallel_thread_count( const size_t threads )
+{
+    if ( threads ) {
+        return threads;
+    }
+    const size_t n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+// calls fn( worker, begin, end ) for chunks covering [0, n), using up to threads threads (0: one per hardware thread)
+// chunk boundaries are multiples of align; worker is in \{ 0 ... parallel_thread_count( threads ) - 1 \} and no two chunks with the same worker run at the same time
+template< typename F >
+void parallel_chunks( const size_t n, const size_t align, const size_t threads, F fn )
+{
+    const size_t thread_count = parallel_thread_count( threads );
+    size_t chunk = n / ( thread_count * parallel_chunks_per_thread );
+    chunk = ( chunk + align - 1 ) / align * align;
+    if ( chunk == 0 ) {
+        chunk = align;
+    }
+
+    std::atomic< size_t > next { 0 };
+    auto work = [&]
+                ( const size_t worker )
+                -> void
+                {
+                    for ( size_t begin = next.fetch_add( chunk ); begin < n; begin = next.fetch_add( chunk ) ) {
+                        fn( worker, begin, begin + chunk < n ? begin + chunk : n );
+                    }
+                };
+
+    std::vector< std::thread > workers;
+    for ( size_t w = 1; w < thread_count && w * chunk < n; w++ ) {
+        workers.emplace_back( work, w );
+    }
+    work( 0 );
+    for ( std::thread& t : workers ) {
+        t.join();
+    }
+}
+
+// a worker's partial result in parallel_reduce. Cacheline aligned (and thus padded to whole cachelines), so workers folding into their partials never write to the same cacheline.
+template< typename T >
+struct alignas( 64 ) ParallelPartial
+{
+    T value;
+};
+
+// slots per cacheline of keys, the alignment of chunks given to parallel_chunks
+template< typename K >
+constexpr size_t parallel_align()
+{
+    return 64 / sizeof( K ) ? 64 / sizeof( K ) : 1;
+}
+
+}
+
+}
@@ -0,0 +1,423 @@
+/*
+  Hashmap over a key set that is known up front, using a minimal perfect hash function.
+  Copyright (C) 2018 Sio Kreuzer
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Built from all of it's keys and values at once, after which the set of keys can not change (values can).
+// 100% load factor (length == count) like HashMapLF100, but lookups are O(1): every key has exactly one slot it can be in, so a lookup is
+// -> one read of the key's pilot,
+// -> one key comparison in the slot the pilot sends it to.
+// Misses cost the same as hits, there is no probing and no empty key.
+// The slot is found with a PTHash-style "hash and displace" minimal perfect hash function:
+// -> keys are split into buckets of bucket_load keys on average by the high bits of their mixed hash, remixed with Murmur3Mix (only Index::mix is used, the Index policy does not reduce anything here)
+//    -> bucket sizes have to be random: FibonacciMix spreads sequential keys so evenly that every bucket ends up with bucket_load keys, leaving no small buckets to fill the last free slots with
+// -> every bucket gets a pilot, chosen at build time so that slot_of( mixed, pilot ) of all keys in the bucket is distinct and not taken by any earlier bucket (largest buckets first)
+// -> pilots take up 32 / bucket_load bits per key
+// Building takes O(n log n) time and a few words of temporary memory per key. It fails (valid() is false, the map is empty) if two keys are equal or their mixed hashes are.
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include <utility>
+#include <type_traits>
+#include <cassert>
+
+#include "StaticHashMap.hpp"
+#include "IndexPolicy.hpp"
+#include "Allocator.hpp"
+#include "Optional.hpp"
+
+#include "utils.hpp"
+
+namespace LibSio
+{
+
+template< typename K
+        , typename V
+        , size_t ( *_hash )( const K* const x ) = standard_hash< K >
+        , bool ( *eq )( const K* const a, const K* const b ) = standard_eq< K >
+        , typename Index = ModuloIndex<>
+        , typename Alloc = DefaultAllocator
+        >
+struct PerfectHashMap
+{
+    typedef PerfectHashMap< K, V, _hash, eq, Index, Alloc > own_type;
+
+    constexpr static const size_t no_index = __SIZE_MAX__;
+    constexpr static const size_t get_many_batch = 16; // keys hashed and prefetched ahead of resolving them in get_many()
+    constexpr static const size_t bucket_load = 4; // keys per bucket on average
+    constexpr static const u64 max_pilot = 0xffffffffLU;
+
+    // lookup_key< K, Q > for Q's the map may be searched by (see get_ref( const Q& ))
+    template< typename Q >
+    using lookup_for = typename std::enable_if< detail::heterogeneous_lookup< K, typename std::decay< Q >::type, _hash >::value
+                                              , detail::heterogeneous_lookup< K, typename std::decay< Q >::type, _hash >
+                                              >::type;
+
+    byte* kvs; // layout as in StaticHashMap, every slot is full
+    u32* pilots;
+    size_t length;
+    size_t bucket_count;
+    bool built;
+
+    K* keys()
+    {
+        return ( K* ) kvs;
+    }
+
+    V* values()
+    {
+        return ( V* ) ( kvs + key_arr_len_in_bytes< K, V >( length ) );
+    }
+
+    static inline size_t remix( const size_t mixed )
+    {
+        return Murmur3Mix::mix( mixed );
+    }
+
+    static inline size_t bucket_of( const size_t mixed, const size_t buckets )
+    {
+        return FastRangeIndex< IdentityMix >::index( mixed, buckets );
+    }
+
+    // murmur3 is a bijection, so keys with distinct mixed hashes never collide for every pilot
+    static inline size_t slot_of( const size_t mixed, const u32 pilot, const size_t length )
+    {
+        return FastRangeIndex< IdentityMix >::index( Murmur3Mix::mix( mixed ^ FibonacciMix::mix( ( size_t ) pilot + 1 ) ), length );
+    }
+
+    inline size_t slot_for( const size_t mixed )
+    {
+        return slot_of( mixed, pilots[bucket_of( mixed, bucket_count )], length );
+    }
+
+    PerfectHashMap() = delete;
+
+    PerfectHashMap( const own_type& ) = delete;
+
+    PerfectHashMap( own_type&& x )
+        : kvs( x.kvs )
+        , pilots( x.pilots )
+        , length( x.length )
+        , bucket_count( x.bucket_count )
+        , built( x.built )
+    {
+        x.kvs = nullptr;
+        x.pilots = nullptr;
+        x.length = 0;
+        x.bucket_count = 0;
+    }
+
+    PerfectHashMap( const K* const ks, const V* const vs, const size_t count )
+        : kvs( nullptr )
+        , pilots( nullptr )
+        , length( 0 )
+        , bucket_count( 0 )
+        , built( false )
+    {
+        build(
+            count
+          , [&]
+            ( const size_t i )
+            -> const K&
+            {
+                return ks[i];
+            }
+          , [&]
+            ( const size_t i )
+            -> const V&
+            {
+                return vs[i];
+            }
+        );
+    }
+
+    PerfectHashMap( const std::vector< std::pair< K, V > >& elements )
+        : kvs( nullptr )
+        , pilots( nullptr )
+        , length( 0 )
+        , bucket_count( 0 )
+        , built( false )
+    {
+        build(
+            elements.size()
+          , [&]
+            ( const size_t i )
+            -> const K&
+            {
+                return elements[i].first;
+            }
+          , [&]
+            ( const size_t i )
+            -> const V&
+            {
+                return elements[i].second;
+            }
+        );
+    }
+
+    ~PerfectHashMap()
+    {
+        if ( kvs ) {
+            for ( size_t i = 0; i < length; i++ ) {
+                callDestructorIfExistent< K >( keys() + i );
+                callDestructorIfExistent< V >( values() + i );
+            }
+            Alloc::dealloc( kvs, overall_arr_len_in_bytes< K, V >( length ) );
+        }
+        if ( pilots ) {
+            Alloc::dealloc( pilots, bucket_count * sizeof( u32 ) );
+        }
+    }
+
+    // finds a pilot for every bucket, then copies key_at( i )/value_at( i ) into the slots they hash to. Only called by the constructors.
+    template< typename KeyAt, typename ValueAt >
+    void build( const size_t count, KeyAt key_at, ValueAt value_at )
+    {
+        struct bucket
+        {
+            size_t index;
+            size_t begin; // into order
+            size_t end;
+        };
+
+        built = true;
+        if ( count == 0 ) {
+            return;
+        }
+
+        const size_t buckets = ( count + bucket_load - 1 ) / bucket_load;
+        std::vector< size_t > mixed( count );
+        std::vector< size_t > order( count ); // indices of keys, grouped by bucket
+        for ( size_t i = 0; i < count; i++ ) {
+            mixed[i] = remix( Index::mix( _hash( &( key_at( i ) ) ) ) );
+            order[i] = i;
+        }
+        std::sort(
+            order.begin()
+          , order.end()
+          , [&]
+            ( const size_t a, const size_t b )
+            -> bool
+            {
+                return mixed[a] < mixed[b]; // bucket_of is monotonic in mixed
+            }
+        );
+
+        std::vector< bucket > by_size;
+        for ( size_t i = 0; i < count; ) {
+            const size_t b = bucket_of( mixed[order[i]], buckets );
+            size_t j = i + 1;
+            for ( ; j < count && bucket_of( mixed[order[j]], buckets ) == b; j++ ) {
+                if ( mixed[order[j]] == mixed[order[j - 1]] ) {
+                    built = false; // equal keys (or a hash collision), no pilot could ever separate them
+                    return;
+                }
+            }
+            by_size.push_back( { b, i, j } );
+            i = j;
+        }
+        std::stable_sort(
+            by_size.begin()
+          , by_size.end()
+          , []
+            ( const bucket& a, const bucket& b )
+            -> bool
+            {
+                return a.end - a.begin > b.end - b.begin;
+            }
+        );
+
+        std::vector< u32 > found( buckets, 0 );
+        std::vector< bool > taken( count, false );
+        std::vector< size_t > slot_of_key( count );
+        for ( const bucket& b : by_size ) {
+            u64 pilot = 0;
+            for ( ; pilot <= max_pilot; pilot++ ) {
+                size_t k = b.begin;
+                for ( ; k < b.end; k++ ) {
+                    const size_t slot = slot_of( mixed[order[k]], ( u32 ) pilot, count );
+                    if ( taken[slot] ) {
+                        break;
+                    }
+                    taken[slot] = true;
+                    slot_of_key[order[k]] = slot;
+                }
+                if ( k == b.end ) {
+                    break;
+                }
+                for ( size_t l = b.begin; l < k; l++ ) {
+                    taken[slot_of_key[order[l]]] = false;
+                }
+            }
+            if ( pilot > max_pilot ) {
+                built = false;
+                return;
+            }
+            found[b.index] = ( u32 ) pilot;
+        }
+
+        length = count;
+        bucket_count = buckets;
+        kvs = ( byte* ) Alloc::alloc( overall_arr_len_in_bytes< K, V >( length ), 64 );
+        assert( kvs );
+        pilots = ( u32* ) Alloc::alloc( bucket_count * sizeof( u32 ), alignof( u32 ) );
+        assert( pilots );
+        memcpy( pilots, found.data(), bucket_count * sizeof( u32 ) );
+        for ( size_t i = 0; i < count; i++ ) {
+            new( keys() + slot_of_key[i] ) K( key_at( i ) );
+            new( values() + slot_of_key[i] ) V( value_at( i ) );
+        }
+    }
+
+    // false if building the map failed (see above)
+    bool valid() const
+    {
+        return built;
+    }
+
+    // index of k, no_index if k is not in the map
+    size_t get_index_for_key( const K* const k )
+    {
+        if ( length == 0 ) {
+            return no_index;
+        }
+        const size_t index = slot_for( remix( Index::mix( _hash( k ) ) ) );
+        return eq( keys() + index, k ) ? index : no_index;
+    }
+
+    V* get_ref( const K& k )
+    {
+        auto index = get_index_for_key( &k );
+        if ( index != no_index ) {
+            return values() + index;
+        } else {
+            return nullptr;
+        }
+    }
+
+    Optional< V > get( const K& k )
+    {
+        auto el = get_ref( k );
+        if ( el ) {
+            return Just< V >( *el );
+        } else {
+            return Nothing< V >();
+        }
+    }
+
+    // get_ref/get without constructing a K, e.g. by a const char* or std::string_view for String keys (see lookup_key in utils.hpp)
+    template< typename Q, typename L = lookup_for< Q > >
+    V* get_ref( const Q& q )
+    {
+        if ( length == 0 ) {
+            return nullptr;
+        }
+        const size_t index = slot_for( remix( Index::mix( L::hash( q ) ) ) );
+        return L::eq( keys() + index, q ) ? values() + index : nullptr;
+    }
+
+    template< typename Q, typename L = lookup_for< Q > >
+    Optional< V > get( const Q& q )
+    {
+        auto el = get_ref( q );
+        if ( el ) {
+            return Just< V >( *el );
+        } else {
+            return Nothing< V >();
+        }
+    }
+
+    // get_ref for n keys at once: out[i] = get_ref( ks[i] )
+    // hashes a batch of keys and prefetches their pilots, then their slots, before comparing any keys, so the cache misses overlap
+    void get_many( const K* const ks, const size_t n, V** const out )
+    {
+        size_t mixed[get_many_batch];
+        size_t slot[get_many_batch];
+        if ( length == 0 ) {
+            for ( size_t i = 0; i < n; i++ ) {
+                out[i] = nullptr;
+            }
+            return;
+        }
+        for ( size_t b = 0; b < n; b += get_many_batch ) {
+            const size_t batch = n - b < get_many_batch ? n - b : get_many_batch;
+            for ( size_t j = 0; j < batch; j++ ) {
+                mixed[j] = remix( Index::mix( _hash( ks + b + j ) ) );
+                __builtin_prefetch( pilots + bucket_of( mixed[j], bucket_count ) );
+            }
+            for ( size_t j = 0; j < batch; j++ ) {
+                slot[j] = slot_for( mixed[j] );
+                __builtin_prefetch( keys() + slot[j] );
+                __builtin_prefetch( values() + slot[j] );
+            }
+            for ( size_t j = 0; j < batch; j++ ) {
+                out[b + j] = eq( keys() + slot[j], ks + b + j ) ? values() + slot[j] : nullptr;
+            }
+        }
+    }
+
+    void foreach_value( void ( *fn )( V* value ) )
+    {
+        foreach_value_lambda( fn );
+    }
+
+    template< typename F >
+    void foreach_value_lambda( F fn )
+    {
+        for ( size_t i = 0; i < length; i++ ) {
+            fn( values() + i );
+        }
+    }
+
+    void foreach( void ( *fn )( const K* key, V* value ) )
+    {
+        foreach_lambda( fn );
+    }
+
+    template< typename F >
+    void foreach_lambda( F fn )
+    {
+        for ( size_t i = 0; i < length; i++ ) {
+            fn( ( const K* ) keys() + i, values() + i );
+        }
+    }
+
+    // foreach/foreach_value for any callable (lambdas with captures, function objects), which unlike std::function can be inlined
+    template< typename F >
+    void foreach( F fn )
+    {
+        foreach_lambda( fn );
+    }
+
+    template< typename F >
+    void foreach_value( F fn )
+    {
+        foreach_value_lambda( fn );
+    }
+
+    bool empty()
+    {
+        return length == 0;
+    }
+
+    // count of elements in container
+    size_t count()
+    {
+        return length;
+    }
+};
+
+}
@@ -19,10 +19,19 @@
 
 #include <string.h>
 
+#include <string_view>
+#include <utility>
+#include <functional>
+
+#include "utils.hpp"
+#include "Allocator.hpp"
+
 namespace LibSio
 {
 
-struct RefCountedString
+// Alloc: where the string (and it's reference count, which is stored in front of it) comes from, see Allocator.hpp
+template< typename Alloc = DefaultAllocator >
+struct RefCountedStringT
 {
     char const* const str;
 
@@ -31,18 +40,25 @@ struct RefCountedString
         return *( reinterpret_cast< uint64_t* >( const_cast< char* >( str ) - sizeof( uint64_t ) ) );
     }
 
-    RefCountedString() = delete;
+    // size of the allocation backing str (only computed if Alloc wants to know)
+    static inline size_t alloc_len_in_bytes( const size_t length )
+    {
+        return length + 1 + sizeof( uint64_t );
+    }
+
+    RefCountedStringT() = delete;
 
-    RefCountedString( char const* s )
+    RefCountedStringT( char const* s )
         : str { nullptr }
     {
         // this is all kinda hacky because we want to compute the length only once if possible (that is, we walk the input two times and not more than that)
         size_t const length = strlen( s );
         char* const _str =
-    reinterpret_cast< char* >( calloc( length + 1 + sizeof( uint64_t ), sizeof( char ) ) ) + sizeof( uint64_t );
+    reinterpret_cast< char* >( Alloc::alloc( alloc_len_in_bytes( length ), alignof( uint64_t ) ) ) + sizeof( uint64_t );
 
-        // copy to str
-        strncpy( _str, s, length );
+        // copy to str, including the terminator, and start counting at 0
+        memcpy( _str, s, length + 1 );
+        *( reinterpret_cast< uint64_t* >( _str - sizeof( uint64_t ) ) ) = 0;
 
         // set str (hacky)
         memcpy( const_cast< char** >( &str ), &_str, sizeof( char* ) );
@@ -50,17 +66,19 @@ struct RefCountedString
         ref();
     }
 
-    RefCountedString( RefCountedString const& rcs )
+    RefCountedStringT( RefCountedStringT const& rcs )
         : str { rcs.str }
     {
         ref();
     }
 
-    ~RefCountedString()
+    ~RefCountedStringT()
     {
         unref();
         if ( refcount() == 0 ) {
-            free( reinterpret_cast< void* >( const_cast< char* >( str ) - sizeof( uint64_t ) ) );
+            Alloc::dealloc( reinterpret_cast< void* >( const_cast< char* >( str ) - sizeof( uint64_t ) )
+                          , Alloc::sized_dealloc ? alloc_len_in_bytes( strlen( str ) ) : 0
+                          );
         }
     }
 
@@ -81,20 +99,97 @@ struct RefCountedString
         return str;
     }
 
-    RefCountedString& operator=( RefCountedString const& x )
+    RefCountedStringT& operator=( RefCountedStringT const& x )
     {
-        this -> ~RefCountedString();
-        new( this ) RefCountedString( x );
+        this -> ~RefCountedStringT();
+        new( this ) RefCountedStringT( x );
         return *this;
     }
+
+    // same contents (equal if both refer to the same string, without comparing it)
+    bool operator==( RefCountedStringT const& x ) const
+    {
+        return str == x.str || 0 == strcmp( str, x.str );
+    }
+
+    bool operator!=( RefCountedStringT const& x ) const
+    {
+        return !( *this == x );
+    }
+};
+
+typedef RefCountedStringT<> RefCountedString;
+
+// the reference count lives in the heap allocation, not in the object
+template< typename Alloc >
+struct is_trivially_relocatable< RefCountedStringT< Alloc > >
+    : std::true_type
+{};
+
+// maps keyed by RefCountedString may be searched with a null terminated char*, a std::string_view or a ( pointer, length ) pair
+// hashes have to match std::hash< RefCountedString > below
+template< typename Alloc >
+struct lookup_key< RefCountedStringT< Alloc >, std::pair< const char*, size_t > >
+{
+    static const bool value = true;
+
+    static size_t hash( const std::pair< const char*, size_t >& q )
+    {
+        return std::_Hash_impl::hash( q.first, q.second );
+    }
+
+    static bool eq( const RefCountedStringT< Alloc >* const k, const std::pair< const char*, size_t >& q )
+    {
+        return strlen( k -> c_str() ) == q.second
+            && 0 == memcmp( k -> c_str(), q.first, q.second );
+    }
+};
+
+template< typename Alloc >
+struct lookup_key< RefCountedStringT< Alloc >, std::string_view >
+{
+    typedef lookup_key< RefCountedStringT< Alloc >, std::pair< const char*, size_t > > pair_lookup;
+
+    static const bool value = true;
+
+    static size_t hash( const std::string_view& q )
+    {
+        return pair_lookup::hash( std::make_pair( q.data(), q.size() ) );
+    }
+
+    static bool eq( const RefCountedStringT< Alloc >* const k, const std::string_view& q )
+    {
+        return pair_lookup::eq( k, std::make_pair( q.data(), q.size() ) );
+    }
 };
 
+template< typename Alloc >
+struct lookup_key< RefCountedStringT< Alloc >, const char* >
+{
+    static const bool value = true;
+
+    static size_t hash( const char* const q )
+    {
+        return std::_Hash_impl::hash( q, strlen( q ) );
+    }
+
+    static bool eq( const RefCountedStringT< Alloc >* const k, const char* const q )
+    {
+        return 0 == strcmp( k -> c_str(), q );
+    }
+};
+
+template< typename Alloc >
+struct lookup_key< RefCountedStringT< Alloc >, char* >
+    : lookup_key< RefCountedStringT< Alloc >, const char* >
+{};
+
 }
 
-template<>
-struct std::hash< LibSio::RefCountedString >
+template< typename Alloc >
+struct std::hash< LibSio::RefCountedStringT< Alloc > >
 {
-    size_t operator()( const LibSio::RefCountedString& x ) const
+    size_t operator()( const LibSio::RefCountedStringT< Alloc >& x ) const
     {
         return std::_Hash_impl::hash( x.c_str(), strlen( x.c_str() ) );
     }
@@ -0,0 +1,374 @@
+/*
+  HashMap split into independently locked shards, for concurrent use.
+  Copyright (C) 2018 Sio Kreuzer
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// 2^shard_bits HashMaps, each with it's own lock, on it's own cacheline(s).
+// -> a key's shard is taken from the shard_bits bits of it's mixed hash starting at bit shard_shift (32), which feed neither HashMap's control byte fragment (bits 0 ... 6 and 57 ... 63, see ControlBytes.hpp) nor, by default (MaskIndex), it's index, so keys within a shard are still spread over the whole table and the fragments
+//    -> with an Index policy that indexes by the high bits (ShiftIndex, FastRangeIndex), a shard with more than 2^( 32 - shard_bits ) slots would index by the shard bits as well: use MaskIndex or ModuloIndex for shards that large
+// -> every operation locks exactly one shard (apart from foreach/count/clear, which lock one shard at a time), a resize only blocks it's own shard
+//    -> a shard stays locked for as long as the operation takes: without incremental_resize, an insert that resizes a shard rehashes the whole shard (O(shard size)) before unlocking it, as do foreach/count/clear for the shard they are in
+//    -> incremental_resize is passed on to the shards and spreads a resize over the operations that follow, so no single one holds the lock for long
+//    -> threads waiting for a shard spin briefly, then yield their time slice until it's free (see ShardLock), so a long resize does not keep them busy
+// -> each shard is a plain HashMap, so lookups keep the two cacheline guarantee
+// Values are never handed out by pointer, as the pointer would be invalidated by a concurrent insert into the same shard: use get (copies the value) or visit (runs a function on the value under the shard's lock) instead.
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <cassert>
+
+#include "HashMap.hpp"
+
+#include "utils.hpp"
+
+namespace LibSio
+{
+
+namespace detail
+{
+
+// test and test-and-set lock that spins for spin_limit rounds, then yields to other threads between tries
+// most operations hold a shard's lock for a few cache misses, which spinning covers, but a resize or foreach holds it for O(shard size)
+struct ShardLock
+{
+    static const size_t spin_limit = 128;
+
+    std::atomic< bool > locked { false };
+
+    void lock()
+    {
+        size_t spins = 0;
+        while ( locked.exchange( true, std::memory_order_acquire ) ) {
+            while ( locked.load( std::memory_order_relaxed ) ) {
+                if ( spins < spin_limit ) {
+                    spins++;
+#if defined( __x86_64__ ) || defined( __i386__ )
+                    __builtin_ia32_pause();
+#endif
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        }
+    }
+
+    void unlock()
+    {
+        locked.store( false, std::memory_order_release );
+    }
+};
+
+}
+
+template< typename K, typename V
+        , size_t ( *_hash )( const K* const x ) = standard_hash< K >
+        , bool ( *eq )( const K* const a, const K* const b ) = standard_eq< K >
+        , typename Index = MaskIndex<>
+        , bool incremental_resize = false
+        , bool store_hash = false
+        , size_t shard_bits = 6 // 2^6 = 64 shards
+        , typename Alloc = DefaultAllocator > // used for the shards' tables
+struct ShardedHashMap
+{
+    typedef ShardedHashMap< K, V, _hash, eq, Index, incremental_resize, store_hash, shard_bits, Alloc > own_type;
+    typedef HashMap< K, V, _hash, eq, Index, incremental_resize, store_hash, false, Alloc > map_type;
+
+    static const size_t shard_count = ( ( size_t ) 1 ) << shard_bits;
+    static const size_t shard_shift = 32; // lowest bit of the mixed hash the shard is taken from
+    static_assert( shard_bits > 0 && shard_bits <= 25, "shard_bits must be within 1 ... 25 (the shard bits must stay clear of the fragment bits from 57 on)" );
+
+    struct alignas( 64 ) shard
+    {
+        detail::ShardLock lock;
+        map_type map;
+
+        shard( K empty_key )
+            : lock()
+            , map( empty_key )
+        {}
+    };
+
+    // constructed in place, as shards can be neither copied nor moved
+    alignas( 64 ) byte shards_storage[shard_count * sizeof( shard )];
+
+    inline shard* shards()
+    {
+        return ( shard* ) shards_storage;
+    }
+
+    ShardedHashMap() = delete;
+
+    ShardedHashMap( K empty_key )
+    {
+        for ( size_t i = 0; i < shard_count; i++ ) {
+            new( shards() + i ) shard( empty_key );
+        }
+    }
+
+    ShardedHashMap( const own_type& ) = delete;
+
+    ~ShardedHashMap()
+    {
+        for ( size_t i = 0; i < shard_count; i++ ) {
+            shards()[i].~shard();
+        }
+    }
+
+    static inline size_t shard_of( const size_t hashed )
+    {
+        return ( hashed >> shard_shift ) & ( shard_count - 1 );
+    }
+
+    // runs fn( s ) with s (the shard a key with mixed hash hashed belongs to) locked
+    template< typename F >
+    inline auto locked( const size_t hashed, F fn )
+    {
+        shard& s = shards()[shard_of( hashed )];
+        s.lock.lock();
+        auto x = fn( s );
+        s.lock.unlock();
+        return x;
+    }
+
+    // runs fn( V* ) on the value of k (or fn( nullptr ) if k is not in the map) with it's shard locked, returns whatever fn returns
+    template< typename F >
+    auto visit( const K& k, F fn )
+    {
+        const size_t hashed = map_type::hash_full( &k );
+        return locked(
+            hashed
+          , [&]
+            ( shard& s )
+            {
+                return fn( s.map.get_ref_with(
+                    hashed
+                  , [&]
+                    ( const K* const x )
+                    -> bool
+                    {
+                        return eq( x, &k );
+                    }
+                ) );
+            }
+        );
+    }
+
+    Optional< V > get( const K& k )
+    {
+        return visit(
+            k
+          , []
+            ( V* x )
+            -> Optional< V >
+            {
+                if ( x ) {
+                    return Just< V >( *x );
+                } else {
+                    return Nothing< V >();
+                }
+            }
+        );
+    }
+
+    // get/rm without constructing a K (see HashMap::get_ref( const Q& ))
+    template< typename Q, typename L = typename map_type::template lookup_for< Q > >
+    Optional< V > get( const Q& q )
+    {
+        return locked(
+            Index::mix( L::hash( q ) )
+          , [&]
+            ( shard& s )
+            -> Optional< V >
+            {
+                return s.map.get( q );
+            }
+        );
+    }
+
+    template< typename Q, typename L = typename map_type::template lookup_for< Q > >
+    void rm( const Q& q )
+    {
+        locked(
+            Index::mix( L::hash( q ) )
+          , [&]
+            ( shard& s )
+            -> bool
+            {
+                s.map.rm( q );
+                return true;
+            }
+        );
+    }
+
+    bool insert( const K& k, V& v )
+    {
+        return emplace( k, v );
+    }
+
+    // returns true on success, false if key already in map
+    template< typename... Args >
+    bool emplace( const K& k, Args... args )
+    {
+        const size_t hashed = map_type::hash_full( &k );
+        return locked(
+            hashed
+          , [&]
+            ( shard& s )
+            -> bool
+            {
+                if ( eq( &( s.map.empty_key ), &k ) ) {
+                    return false; // attempting to insert empty key
+                }
+                return s.map.emplace_hashed( hashed, k, args... );
+            }
+        );
+    }
+
+    void rm( const K& k )
+    {
+        const size_t hashed = map_type::hash_full( &k );
+        locked(
+            hashed
+          , [&]
+            ( shard& s )
+            -> bool
+            {
+                s.map.rm_with(
+                    hashed
+                  , [&]
+                    ( const K* const x )
+                    -> bool
+                    {
+                        return eq( x, &k );
+                    }
+                );
+                return true;
+            }
+        );
+    }
+
+    // runs fn( s ) on every shard in turn, each one locked while fn runs on it
+    template< typename F >
+    inline void foreach_shard( F fn )
+    {
+        for ( size_t i = 0; i < shard_count; i++ ) {
+            shard& s = shards()[i];
+            s.lock.lock();
+            fn( s );
+            s.lock.unlock();
+        }
+    }
+
+    void clear()
+    {
+        foreach_shard(
+            []
+            ( shard& s )
+            -> void
+            {
+                s.map.clear();
+            }
+        );
+    }
+
+    // NOTE: not a snapshot - shards are visited one after the other, concurrent writes to shards that have not been visited yet show up
+    template< typename F >
+    void foreach_value_lambda( F fn )
+    {
+        foreach_shard(
+            [&]
+            ( shard& s )
+            -> void
+            {
+                s.map.foreach_value_lambda( fn );
+            }
+        );
+    }
+
+    template< typename F >
+    void foreach_lambda( F fn )
+    {
+        foreach_shard(
+            [&]
+            ( shard& s )
+            -> void
+            {
+                s.map.foreach_lambda( fn );
+            }
+        );
+    }
+
+    // foreach/foreach_value for any callable (lambdas with captures, function objects), which unlike std::function can be inlined
+    template< typename F >
+    void foreach( F fn )
+    {
+        foreach_lambda( fn );
+    }
+
+    template< typename F >
+    void foreach_value( F fn )
+    {
+        foreach_value_lambda( fn );
+    }
+
+    void foreach_value( void ( *fn )( V* value ) )
+    {
+        foreach_shard(
+            [&]
+            ( shard& s )
+            -> void
+            {
+                s.map.foreach_value( fn );
+            }
+        );
+    }
+
+    void foreach( void ( *fn )( const K* key, V* value ) )
+    {
+        foreach_shard(
+            [&]
+            ( shard& s )
+            -> void
+            {
+                s.map.foreach( fn );
+            }
+        );
+    }
+
+    // count of elements in container, see foreach
+    size_t count()
+    {
+        size_t n = 0;
+        foreach_shard(
+            [&]
+            ( shard& s )
+            -> void
+            {
+                s.map.foreach_cell(
+                    [&]
+                    ( __attribute__((unused)) const K* _k, __attribute__((unused)) V* _v )
+                    -> void
+                    {
+                        n++;
+                    }
+                );
+            }
+        );
+        return n;
+    }
+};
+
+}
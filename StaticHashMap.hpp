@@ -17,12 +17,22 @@
 */
 // Efficient cache-friendly dense (as dense as possible, anyway) statically sized hashmap implementation using linear probing.
 // Does not use robin hood hashing - pointers this table hands out are valid for as long as the table contains the element the pointer points to
+// Index: how hashes are mixed and reduced to positions, see IndexPolicy.hpp. Policies that need a power of two length may only be used with power of two lengths.
+// Alloc: where the array comes from, see Allocator.hpp (e.g. HugePageAllocator for large tables)
+// Layout: where keys and values are within the array, see Layout.hpp. SplitLayout (all keys, then all values, keys() and values() are plain arrays) by default; AutoLayout/InterleavedLayout interleave small keys and values in cacheline sized buckets, so a hit only costs one cache miss.
 #pragma once
 
 #include <cstring>
 #include <cassert>
+#include <utility>
+#include <type_traits>
+#include <vector>
 
 #include "Optional.hpp"
+#include "IndexPolicy.hpp"
+#include "Allocator.hpp"
+#include "Layout.hpp"
+#include "Parallel.hpp"
 #include "utils.hpp"
 
 #include <functional>
@@ -45,17 +55,24 @@ size_t standard_hash( const T* const x )
     return h( *x );
 }
 
-template< typename K, typename V >
-inline size_t key_arr_len_in_bytes( size_t length )
+namespace detail
 {
-    return ( length * sizeof( K ) )
-         + ( ( length * sizeof( K ) ) % alignof( V ) );
-}
 
-template< typename K, typename V >
-inline size_t overall_arr_len_in_bytes( size_t length )
+// whether a map keyed by K using hash function _hash may be searched by a Q (see lookup_key in utils.hpp)
+// only checks the hash function once lookup_key says yes, so standard_hash< K > does not get instantiated for keys without a std::hash
+template< typename K, typename Q, size_t ( *_hash )( const K* const x ), bool = lookup_key< K, Q >::value >
+struct heterogeneous_lookup
+{
+    static const bool value = false;
+};
+
+template< typename K, typename Q, size_t ( *_hash )( const K* const x ) >
+struct heterogeneous_lookup< K, Q, _hash, true >
+    : lookup_key< K, Q >
 {
-    return key_arr_len_in_bytes< K, V >( length ) + ( length * sizeof( V ) );
+    static const bool value = _hash == standard_hash< K >;
+};
+
 }
 
 template< typename K, size_t ( *_hash )( const K* const x ) >
@@ -69,39 +86,64 @@ template< typename K
         , typename V
         , size_t ( *_hash )( const K* const x ) = standard_hash< K >
         , bool ( *eq )( const K* const a, const K* const b ) = standard_eq< K >
+        , typename Index = ModuloIndex<>
+        , typename Alloc = DefaultAllocator
+        , typename Layout = SplitLayout< K, V >
         >
 struct StaticHashMap
 {
-    typedef StaticHashMap< K, V, _hash, eq > own_type;
+    typedef StaticHashMap< K, V, _hash, eq, Index, Alloc, Layout > own_type;
 
     typedef unsigned char byte;
     constexpr static const size_t no_index = __SIZE_MAX__;
+    constexpr static const size_t get_many_batch = 16; // keys hashed and prefetched ahead of resolving them in get_many()
 
     // improves the distribution in case of a bad hash function (which std::hash on integers typically is)
     static inline size_t hash( const K* const x, const size_t map_length )
     {
-        return hash_secondary< K, _hash >( x ) % map_length;
+        return Index::index( Index::mix( _hash( x ) ), map_length );
     }
 
-    size_t key_arr_len_in_bytes()
-    {
-        return LibSio::key_arr_len_in_bytes< K, V >( length );
-    }
+    // lookup_key< K, Q > for Q's the map may be searched by (see get_ref( const Q& ))
+    template< typename Q >
+    using lookup_for = typename std::enable_if< detail::heterogeneous_lookup< K, typename std::decay< Q >::type, _hash >::value
+                                              , detail::heterogeneous_lookup< K, typename std::decay< Q >::type, _hash >
+                                              >::type;
 
     size_t overall_arr_len_in_bytes()
     {
-        return LibSio::overall_arr_len_in_bytes< K, V >( length );
+        return Layout::arr_len_in_bytes( length );
     }
 
     byte* kvs;
     size_t length;
     K empty_key;
 
+    // key/value of slot i, wherever Layout puts them
+    K* key( const size_t i )
+    {
+        return ( K* ) ( kvs + Layout::key_offset( length, i ) );
+    }
+
+    V* value( const size_t i )
+    {
+        return ( V* ) ( kvs + Layout::value_offset( length, i ) );
+    }
+
+    // keys and values as arrays, only with SplitLayout (other layouts do not keep them in arrays of their own)
+    template< typename L = Layout, typename = typename std::enable_if< std::is_same< L, SplitLayout< K, V > >::value >::type >
+    size_t key_arr_len_in_bytes()
+    {
+        return LibSio::key_arr_len_in_bytes< K, V >( length );
+    }
+
+    template< typename L = Layout, typename = typename std::enable_if< std::is_same< L, SplitLayout< K, V > >::value >::type >
     K* keys()
     {
         return ( K* ) kvs;
     }
 
+    template< typename L = Layout, typename = typename std::enable_if< std::is_same< L, SplitLayout< K, V > >::value >::type >
     V* values()
     {
         return ( V* ) ( kvs + key_arr_len_in_bytes() );
@@ -113,28 +155,37 @@ struct StaticHashMap
         : StaticHashMap( const_cast< own_type* >( &x ) )
     {}
 
+    // same length, so copies slot for slot instead of rehashing everything
     StaticHashMap( own_type* x )
         : kvs( nullptr )
         , length( x -> length )
         , empty_key( x -> empty_key )
     {
         assert( length );
-        kvs = ( byte* ) calloc( 1, overall_arr_len_in_bytes() );
+        kvs = ( byte* ) Alloc::alloc( overall_arr_len_in_bytes(), 64 );
         assert( kvs );
 
-        for ( size_t i = 0; i < length; i++ ) {
-            new( keys() + i ) K( empty_key );
+        if constexpr ( std::is_trivially_copyable< K >::value && std::is_trivially_copyable< V >::value ) {
+            memcpy( kvs, x -> kvs, overall_arr_len_in_bytes() );
+        } else {
+            for ( size_t i = 0; i < length; i++ ) {
+                if ( eq( x -> key( i ), &empty_key ) ) {
+                    new( key( i ) ) K( empty_key );
+                } else {
+                    new( key( i ) ) K( *( x -> key( i ) ) );
+                    new( value( i ) ) V( *( x -> value( i ) ) );
+                }
+            }
         }
+    }
 
-        own_type* self = this;
-        x -> foreach_lambda(
-            [=]
-            ( const K* key, V* value )
-            -> void
-            {
-                self -> insert( *key, *value );
-            }
-        );
+    // takes over the array of x, x is left without one (and may only be destroyed or assigned to)
+    StaticHashMap( own_type&& x )
+        : kvs( x.kvs )
+        , length( x.length )
+        , empty_key( x.empty_key )
+    {
+        x.kvs = nullptr;
     }
 
     StaticHashMap( size_t a_length
@@ -145,59 +196,108 @@ struct StaticHashMap
         , empty_key( an_empty_key )
     {
         assert( length );
-        kvs = ( byte* ) calloc( 1, overall_arr_len_in_bytes() );
+        assert( !Index::needs_power_of_two_length || ( length & ( length - 1 ) ) == 0 );
+        kvs = ( byte* ) Alloc::alloc( overall_arr_len_in_bytes(), 64 );
         assert( kvs );
 
         for ( size_t i = 0; i < length; i++ ) {
-            new( keys() + i ) K( empty_key );
+            new( key( i ) ) K( empty_key );
         }
     }
 
     ~StaticHashMap()
     {
-        if ( keys() && values() ) {
+        if ( kvs ) {
             for ( size_t i = 0; i < length; i++ ) {
-                if ( eq( keys() + i, &empty_key ) ) {
-                    callDestructorIfExistent< K >( keys() + i );
+                if ( eq( key( i ), &empty_key ) ) {
+                    callDestructorIfExistent< K >( key( i ) );
                     // no value to destroy
                 } else {
-                    callDestructorIfExistent< K >( keys() + i );
-                    callDestructorIfExistent< V >( values() + i );
+                    callDestructorIfExistent< K >( key( i ) );
+                    callDestructorIfExistent< V >( value( i ) );
                 }
             }
         }
         if ( kvs ) {
-            free( kvs );
+            Alloc::dealloc( kvs, overall_arr_len_in_bytes() );
         }
     }
 
     own_type& operator=( own_type x )
     {
         this -> ~StaticHashMap();
-        new( this ) StaticHashMap< K, V, _hash, eq >( x );
+        new( this ) own_type( std::move( x ) );
         return *this;
     }
 
+    // moves all elements of x into this map (which must have room for them; hashes are recomputed for this map's length)
+    // x is left without an array (and may only be destroyed or assigned to)
+    void relocate_from( own_type& x )
+    {
+        for ( size_t i = 0; i < x.length; i++ ) {
+            if ( eq( x.key( i ), &( x.empty_key ) ) ) {
+                callDestructorIfExistent< K >( x.key( i ) );
+            } else {
+                const size_t index = get_new_index_for_key( x.key( i ) );
+                assert( index < length );
+                callDestructorIfExistent< K >( key( index ) );
+                relocate< K >( key( index ), x.key( i ) );
+                relocate< V >( value( index ), x.value( i ) );
+            }
+        }
+        Alloc::dealloc( x.kvs, x.overall_arr_len_in_bytes() );
+        x.kvs = nullptr;
+    }
+
     // get index for key - key must already be paired with a value in the map
     // index is in elements (length, not size)
     size_t get_index_for_key( const K* const k )
     {
-        size_t hashed = hash( k, length );
+        return find_index(
+            hash( k, length )
+          , [=]
+            ( const K* const x )
+            -> bool
+            {
+                return eq( x, k );
+            }
+        );
+    }
+
+    // index of the first key from hashed onwards that matches( key ) returns true for
+    template< typename M >
+    size_t find_index( const size_t hashed, M matches )
+    {
         for ( size_t i = 0; i < length; i++ ) {
-            size_t index = ( hashed + i ) % length;
-            if ( eq( keys() + index, k ) ) {
+            size_t index = hashed + i < length ? hashed + i : hashed + i - length;
+            if ( matches( key( index ) ) ) {
                 return index;
             }
         }
         return no_index;
     }
 
+    // get_index_for_key for anything the map may be searched by (see lookup_key in utils.hpp)
+    template< typename Q, typename L = lookup_for< Q > >
+    size_t get_index_for_lookup( const Q& q )
+    {
+        return find_index(
+            Index::index( Index::mix( L::hash( q ) ), length )
+          , [&]
+            ( const K* const x )
+            -> bool
+            {
+                return L::eq( x, q ) && !eq( x, &empty_key );
+            }
+        );
+    }
+
     // get a reference into the map (returns NULL on failure, does not traverse values)
     V* get_ref( const K& k )
     {
         auto index = get_index_for_key( &k );
         if ( index != no_index ) {
-            return values() + index;
+            return value( index );
         } else {
             return nullptr;
         }
@@ -213,14 +313,74 @@ struct StaticHashMap
         }
     }
 
+    // get_ref for n keys at once: out[i] = get_ref( ks[i] )
+    // hashes a batch of keys and prefetches the slots they hash to before resolving any of them, so the cache misses overlap
+    void get_many( const K* const ks, const size_t n, V** const out )
+    {
+        size_t hashed[get_many_batch];
+        for ( size_t b = 0; b < n; b += get_many_batch ) {
+            const size_t batch = n - b < get_many_batch ? n - b : get_many_batch;
+            for ( size_t j = 0; j < batch; j++ ) {
+                hashed[j] = hash( ks + b + j, length );
+                __builtin_prefetch( key( hashed[j] ) );
+                __builtin_prefetch( value( hashed[j] ) );
+            }
+            for ( size_t j = 0; j < batch; j++ ) {
+                const K* const k = ks + b + j;
+                const size_t index = find_index(
+                    hashed[j]
+                  , [=]
+                    ( const K* const x )
+                    -> bool
+                    {
+                        return eq( x, k );
+                    }
+                );
+                out[b + j] = index != no_index ? value( index ) : nullptr;
+            }
+        }
+    }
+
+    // get_ref/get/rm without constructing a K, e.g. by a const char* or std::string_view for String keys (see lookup_key in utils.hpp)
+    template< typename Q, typename L = lookup_for< Q > >
+    V* get_ref( const Q& q )
+    {
+        auto index = get_index_for_lookup( q );
+        if ( index != no_index ) {
+            return value( index );
+        } else {
+            return nullptr;
+        }
+    }
+
+    template< typename Q, typename L = lookup_for< Q > >
+    Optional< V > get( const Q& q )
+    {
+        auto el = get_ref( q );
+        if ( el ) {
+            return Just< V >( *el );
+        } else {
+            return Nothing< V >();
+        }
+    }
+
+    template< typename Q, typename L = lookup_for< Q > >
+    void rm( const Q& q )
+    {
+        auto index = get_index_for_lookup( q );
+        if ( index != no_index ) {
+            rm_index( index );
+        }
+    }
+
     // get an index at which there is nothing for this key (if a key/value pair with a key comparing equal to this key is found, returns no_index)
     // index is in elements (length, not size)
     size_t get_new_index_for_key( const K* const k )
     {
         size_t hashed = hash( k, length );
         for ( size_t i = 0; i < length; i++ ) {
-            size_t index = ( hashed + i ) % length;
-            if ( eq( keys() + index, &( empty_key ) ) ) {
+            size_t index = hashed + i < length ? hashed + i : hashed + i - length;
+            if ( eq( key( index ), &( empty_key ) ) ) {
                 return index;
             } else if ( i == length - 1 ) {
                 return no_index - 1;
@@ -239,8 +399,9 @@ struct StaticHashMap
         } else if ( index == no_index - 1 ) {
             return false; // no space left
         } else {
-            new( keys() + index ) K( k );
-            new( values() + index ) V( v );
+            callDestructorIfExistent< K >( key( index ) );
+            new( key( index ) ) K( k );
+            new( value( index ) ) V( v );
             return true;
         }
     }
@@ -257,9 +418,9 @@ struct StaticHashMap
         } else if ( index == no_index - 1 ) {
             return false; // no space left
         } else {
-            callDestructorIfExistent< K >( keys() + index );
-            new( keys() + index ) K( k );
-            new( values() + index ) V( args... );
+            callDestructorIfExistent< K >( key( index ) );
+            new( key( index ) ) K( k );
+            new( value( index ) ) V( args... );
             return true;
         }
     }
@@ -268,17 +429,33 @@ struct StaticHashMap
     {
         auto index = get_index_for_key( &k );
         if ( index != no_index ) {
-            callDestructorIfExistent< K >( keys() + index );
-            callDestructorIfExistent< V >( values() + index );
-            new( keys() + index ) K( empty_key );
+            rm_index( index );
+        }
+    }
+
+    void rm_index( const size_t index )
+    {
+        callDestructorIfExistent< K >( key( index ) );
+        callDestructorIfExistent< V >( value( index ) );
+        new( key( index ) ) K( empty_key );
+    }
+
+    // removes every element pred( key, value ) is true for
+    template< typename P >
+    void rm_if( P pred )
+    {
+        for ( size_t i = 0; i < length; i++ ) {
+            if ( !eq( key( i ), &empty_key ) && pred( ( const K* ) key( i ), value( i ) ) ) {
+                rm_index( i );
+            }
         }
     }
 
     void clear()
     {
         for ( size_t i = 0; i < length; i++ ) {
-            if ( !eq( keys() + i, &( empty_key ) ) ) {
-                rm( *( keys() + i ) );
+            if ( !eq( key( i ), &( empty_key ) ) ) {
+                rm( *key( i ) );
             }
         }
     }
@@ -287,7 +464,7 @@ struct StaticHashMap
     {
         auto index = get_index_for_key( &k );
         if ( index != no_index ) {
-            Optional< V > toreturn = Just< V >( values()[index] );
+            Optional< V > toreturn = Just< V >( *value( index ) );
             rm( k );
             return toreturn;
         } else {
@@ -301,22 +478,23 @@ struct StaticHashMap
     // TODO: map (writing out to a new hashmap)
 
     // NOTE: *insanely* fast when compared to Iterator,
-    // faster than foreach_value_lambda
+    // as fast as foreach_value_lambda (which takes any callable and gets inlined just the same)
     void foreach_value( void ( *fn )( V* value ) )
     {
         for ( size_t i = 0; i < length; i++ ) {
-            if ( !eq( keys() + i, &empty_key ) ) {
-                fn( values() + i );
+            if ( !eq( key( i ), &empty_key ) ) {
+                fn( value( i ) );
             }
         }
     }
 
     // NOTE: *significantly* faster than Iterator
-    void foreach_value_lambda( std::function< void( V* ) > fn )
+    template< typename F >
+    void foreach_value_lambda( F fn )
     {
         for ( size_t i = 0; i < length; i++ ) {
-            if ( !eq( keys() + i, &empty_key ) ) {
-                fn( values() + i );
+            if ( !eq( key( i ), &empty_key ) ) {
+                fn( value( i ) );
             }
         }
     }
@@ -324,21 +502,99 @@ struct StaticHashMap
     void foreach( void ( *fn )( const K* key, V* value ) )
     {
         for ( size_t i = 0; i < length; i++ ) {
-            if ( !eq( keys() + i, &empty_key ) ){
-                fn( keys() + i, values() + i );
+            if ( !eq( key( i ), &empty_key ) ){
+                fn( key( i ), value( i ) );
             }
         }
     }
 
-    void foreach_lambda( std::function< void( const K*, V* ) > fn )
+    template< typename F >
+    void foreach_lambda( F fn )
     {
         for ( size_t i = 0; i < length; i++ ) {
-            if ( !eq( keys() + i, &empty_key ) ){
-                fn( keys() + i, values() + i );
+            if ( !eq( key( i ), &empty_key ) ){
+                fn( key( i ), value( i ) );
             }
         }
     }
 
+    // foreach/foreach_value for any callable (lambdas with captures, function objects), which unlike std::function can be inlined
+    template< typename F >
+    void foreach( F fn )
+    {
+        foreach_lambda( fn );
+    }
+
+    template< typename F >
+    void foreach_value( F fn )
+    {
+        foreach_value_lambda( fn );
+    }
+
+    // foreach/foreach_value on up to threads threads at once (0: one per hardware thread), see Parallel.hpp
+    // fn( key, value ) is called concurrently, for different elements
+    template< typename F >
+    void parallel_foreach( F fn, const size_t threads = 0 )
+    {
+        detail::parallel_chunks(
+            length
+          , detail::parallel_align< K >()
+          , threads
+          , [&]
+            ( __attribute__((unused)) const size_t worker, const size_t begin, const size_t end )
+            -> void
+            {
+                for ( size_t i = begin; i < end; i++ ) {
+                    if ( !eq( key( i ), &empty_key ) ) {
+                        fn( ( const K* ) key( i ), value( i ) );
+                    }
+                }
+            }
+        );
+    }
+
+    template< typename F >
+    void parallel_foreach_value( F fn, const size_t threads = 0 )
+    {
+        parallel_foreach(
+            [&]
+            ( __attribute__((unused)) const K* _, V* v )
+            -> void
+            {
+                fn( v );
+            }
+          , threads
+        );
+    }
+
+    // folds every element into one of a number of per-thread partial results with fn( T& partial, key, value ), each partial starting out as identity
+    // then folds the partials into identity with combine( T& result, const T& partial ) and returns that
+    template< typename T, typename F, typename C >
+    T parallel_reduce( T identity, F fn, C combine, const size_t threads = 0 )
+    {
+        std::vector< detail::ParallelPartial< T > > partials( detail::parallel_thread_count( threads ), detail::ParallelPartial< T > { identity } );
+        detail::parallel_chunks(
+            length
+          , detail::parallel_align< K >()
+          , threads
+          , [&]
+            ( const size_t worker, const size_t begin, const size_t end )
+            -> void
+            {
+                T& partial = partials[worker].value;
+                for ( size_t i = begin; i < end; i++ ) {
+                    if ( !eq( key( i ), &empty_key ) ) {
+                        fn( partial, ( const K* ) key( i ), value( i ) );
+                    }
+                }
+            }
+        );
+        for ( const detail::ParallelPartial< T >& partial : partials ) {
+            combine( identity, partial.value );
+        }
+        return identity;
+    }
+
     bool empty()
     {
         bool is = true;
@@ -370,3 +626,5 @@ struct StaticHashMap
 };
 
 }
+
+#undef inline
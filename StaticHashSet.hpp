@@ -0,0 +1,372 @@
+/*
+  Statically sized hashset using open addressing
+  Copyright (C) 2018 Sio Kreuzer
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// StaticHashMap without values: a StaticHashMap whose values are stateless, laid out by KeysOnlyLayout (see Layout.hpp), so the array holds nothing but keys.
+// -> same probing, same length for the lifetime of the set, same template parameters minus V and Layout
+// -> insert() returns false only if there is no space left (as StaticHashMap::insert), not if the key is already in the set
+// -> lookups, insert() and rm() probe once, from the key's slot up to the first empty one (a key is never placed past an empty slot)
+//    -> removing a key shifts the keys after it back (backward shift deletion, as in HashMap), so there are no tombstones and no empty slot between a key and it's home slot, also after removals
+// Set algebra:
+// -> unite/intersect/subtract change this set in place: intersect and subtract only remove keys, so the keys that stay are never moved or rehashed
+// -> union_of/intersection_of/difference_of build a new set from a copy (slot for slot, no rehashing) of one of the sets and then change that in place, going over whichever set has the shorter table where the result allows it
+#pragma once
+
+#include "StaticHashMap.hpp"
+#include "Layout.hpp"
+
+#include "utils.hpp"
+
+namespace LibSio
+{
+
+template< typename K
+        , size_t ( *_hash )( const K* const x ) = standard_hash< K >
+        , bool ( *eq )( const K* const a, const K* const b ) = standard_eq< K >
+        , typename Index = ModuloIndex<>
+        , typename Alloc = DefaultAllocator
+        >
+struct StaticHashSet
+{
+    typedef StaticHashSet< K, _hash, eq, Index, Alloc > own_type;
+    typedef StaticHashMap< K, detail::SetValue, _hash, eq, Index, Alloc, KeysOnlyLayout< K > > map_type;
+
+    map_type underlying;
+
+    StaticHashSet() = delete;
+
+    StaticHashSet( size_t length, K empty_key )
+        : underlying( length, empty_key )
+    {}
+
+    StaticHashSet( const own_type& x )
+        : underlying( x.underlying )
+    {}
+
+    StaticHashSet( own_type&& x )
+        : underlying( std::move( x.underlying ) )
+    {}
+
+    own_type& operator=( own_type x )
+    {
+        underlying = std::move( x.underlying );
+        return *this;
+    }
+
+    size_t length()
+    {
+        return underlying.length;
+    }
+
+    K empty_key()
+    {
+        return underlying.empty_key;
+    }
+
+    // index of the key from hashed onwards that matches( key ) returns true for, no_index if there is none
+    // free is set to the first empty slot on the way (no_index if there is none), where a key that is not in the set goes
+    // stops at the first empty slot, see rm_at
+    template< typename M >
+    size_t probe( const size_t hashed, M matches, size_t& free )
+    {
+        const size_t length = underlying.length;
+        free = map_type::no_index;
+        for ( size_t i = 0; i < length; i++ ) {
+            const size_t index = hashed + i < length ? hashed + i : hashed + i - length;
+            const K* const x = underlying.key( index );
+            if ( eq( x, &( underlying.empty_key ) ) ) {
+                free = index;
+                return map_type::no_index;
+            } else if ( matches( x ) ) {
+                return index;
+            }
+        }
+        return map_type::no_index;
+    }
+
+    size_t index_of( const K& k, size_t& free )
+    {
+        return probe(
+            map_type::hash( &k, underlying.length )
+          , [&]
+            ( const K* const x )
+            -> bool
+            {
+                return eq( x, &k );
+            }
+          , free
+        );
+    }
+
+    template< typename Q, typename L = typename map_type::template lookup_for< Q > >
+    size_t index_of( const Q& q, size_t& free )
+    {
+        return probe(
+            Index::index( Index::mix( L::hash( q ) ), underlying.length )
+          , [&]
+            ( const K* const x )
+            -> bool
+            {
+                return L::eq( x, q );
+            }
+          , free
+        );
+    }
+
+    bool contains( const K& k )
+    {
+        size_t free;
+        return index_of( k, free ) != map_type::no_index;
+    }
+
+    // contains without constructing a K, see lookup_key in utils.hpp
+    template< typename Q, typename L = typename map_type::template lookup_for< Q > >
+    bool contains( const Q& q )
+    {
+        size_t free;
+        return index_of( q, free ) != map_type::no_index;
+    }
+
+    // returns false on failure (no space left), true otherwise (also if k was in the set already)
+    bool insert( const K& k )
+    {
+        size_t free;
+        if ( index_of( k, free ) != map_type::no_index ) {
+            return true;
+        } else if ( free == map_type::no_index ) {
+            return false;
+        }
+        callDestructorIfExistent< K >( underlying.key( free ) );
+        new( underlying.key( free ) ) K( k );
+        return true;
+    }
+
+    // empties slot hole, then moves every key after it that may be moved back towards it's home slot into the hole, until the next empty slot
+    // keeps every key reachable from it's home slot without passing an empty slot, so probes may stop at the first one
+    void rm_at( size_t hole )
+    {
+        const size_t length = underlying.length;
+        underlying.rm_index( hole );
+        for ( size_t i = hole + 1 < length ? hole + 1 : 0; !eq( underlying.key( i ), &( underlying.empty_key ) ); i = i + 1 < length ? i + 1 : 0 ) {
+            const size_t home = map_type::hash( underlying.key( i ), length );
+            // distances are taken going forward from home and the hole respectively, wrapping around at the end of the table
+            if ( ( i + length - home ) % length >= ( i + length - hole ) % length ) {
+                callDestructorIfExistent< K >( underlying.key( hole ) );
+                relocate< K >( underlying.key( hole ), underlying.key( i ) );
+                new( underlying.key( i ) ) K( underlying.empty_key );
+                hole = i;
+            }
+        }
+    }
+
+    void rm( const K& k )
+    {
+        size_t free;
+        const size_t index = index_of( k, free );
+        if ( index != map_type::no_index ) {
+            rm_at( index );
+        }
+    }
+
+    template< typename Q, typename L = typename map_type::template lookup_for< Q > >
+    void rm( const Q& q )
+    {
+        size_t free;
+        const size_t index = index_of( q, free );
+        if ( index != map_type::no_index ) {
+            rm_at( index );
+        }
+    }
+
+    // removes every key pred( key ) is true for: empties their slots in one pass, then moves the keys that are left back towards their home slots in another
+    // pred is called once per key, unless the table is full (then the first key to go is removed by rm_at beforehand, and pred is called again for the keys before it)
+    template< typename P >
+    void rm_if( P pred )
+    {
+        const size_t length = underlying.length;
+        const K* const empty_key = &( underlying.empty_key );
+        // a slot that is empty before anything is removed: no key goes past it to get from it's home slot to where it is
+        size_t start = 0;
+        while ( start < length && !eq( underlying.key( start ), empty_key ) ) {
+            start++;
+        }
+        if ( start == length ) {
+            size_t i = 0;
+            while ( i < length && !pred( ( const K* ) underlying.key( i ) ) ) {
+                i++;
+            }
+            if ( i == length ) {
+                return;
+            }
+            rm_at( i );
+            start = 0;
+            while ( !eq( underlying.key( start ), empty_key ) ) {
+                start++;
+            }
+        }
+        bool removed = false;
+        for ( size_t i = 0; i < length; i++ ) {
+            if ( !eq( underlying.key( i ), empty_key ) && pred( ( const K* ) underlying.key( i ) ) ) {
+                underlying.rm_index( i );
+                removed = true;
+            }
+        }
+        if ( !removed ) {
+            return;
+        }
+        // going around the table from start, every key is moved to the first empty slot between it's home slot and where it is (if any)
+        for ( size_t n = 1; n < length; n++ ) {
+            const size_t i = start + n < length ? start + n : start + n - length;
+            if ( eq( underlying.key( i ), empty_key ) ) {
+                continue;
+            }
+            size_t j = map_type::hash( underlying.key( i ), length );
+            while ( j != i && !eq( underlying.key( j ), empty_key ) ) {
+                j = j + 1 < length ? j + 1 : 0;
+            }
+            if ( j != i ) {
+                callDestructorIfExistent< K >( underlying.key( j ) );
+                relocate< K >( underlying.key( j ), underlying.key( i ) );
+                new( underlying.key( i ) ) K( *empty_key );
+            }
+        }
+    }
+
+    void clear()
+    {
+        underlying.clear();
+    }
+
+    // calls fn( key ) for every key
+    template< typename F >
+    void foreach( F fn )
+    {
+        underlying.foreach_lambda(
+            [&]
+            ( const K* k, __attribute__((unused)) detail::SetValue* _ )
+            -> void
+            {
+                fn( k );
+            }
+        );
+    }
+
+    // foreach on up to threads threads at once (0: one per hardware thread), see Parallel.hpp
+    template< typename F >
+    void parallel_foreach( F fn, const size_t threads = 0 )
+    {
+        underlying.parallel_foreach(
+            [&]
+            ( const K* k, __attribute__((unused)) detail::SetValue* _ )
+            -> void
+            {
+                fn( k );
+            }
+          , threads
+        );
+    }
+
+    bool empty()
+    {
+        return underlying.empty();
+    }
+
+    // count of elements in container
+    size_t count()
+    {
+        return underlying.count();
+    }
+
+    // adds every key of x. Returns false if this set ran out of space (the keys inserted until then stay in it).
+    bool unite( own_type& x )
+    {
+        bool fits = true;
+        x.foreach(
+            [&]
+            ( const K* k )
+            -> void
+            {
+                fits = fits && insert( *k );
+            }
+        );
+        return fits;
+    }
+
+    // removes every key that is not in x
+    void intersect( own_type& x )
+    {
+        rm_if(
+            [&]
+            ( const K* k )
+            -> bool
+            {
+                return !x.contains( *k );
+            }
+        );
+    }
+
+    // removes every key that is in x, going over whichever of the two sets has the shorter table
+    void subtract( own_type& x )
+    {
+        if ( x.length() < length() ) {
+            x.foreach(
+                [&]
+                ( const K* k )
+                -> void
+                {
+                    rm( *k );
+                }
+            );
+        } else {
+            rm_if(
+                [&]
+                ( const K* k )
+                -> bool
+                {
+                    return x.contains( *k );
+                }
+            );
+        }
+    }
+
+    // a copy of the longer set (of the length of that) with the keys of the smaller one added. The result has no more than the keys that fit into that length.
+    static own_type union_of( own_type& a, own_type& b )
+    {
+        const bool a_larger = a.length() >= b.length();
+        own_type x( a_larger ? a : b );
+        x.unite( a_larger ? b : a );
+        return x;
+    }
+
+    // a copy of the shorter set, with the keys that are not in the longer one removed
+    static own_type intersection_of( own_type& a, own_type& b )
+    {
+        const bool a_smaller = a.length() <= b.length();
+        own_type x( a_smaller ? a : b );
+        x.intersect( a_smaller ? b : a );
+        return x;
+    }
+
+    // a copy of a, with the keys of b removed
+    static own_type difference_of( own_type& a, own_type& b )
+    {
+        own_type x( a );
+        x.subtract( b );
+        return x;
+    }
+};
+
+}
@@ -18,6 +18,7 @@
 #pragma once
 
 #include "utils.hpp"
+#include "Allocator.hpp"
 
 #include <bits/hash_bytes.h>
 
@@ -27,6 +28,8 @@
 #include <cstdio>
 
 #include <string>
+#include <string_view>
+#include <utility>
 #include <locale>
 #include <codecvt>
 
@@ -71,7 +74,8 @@ struct strtools< char >
 
 };
 
-template< typename C >
+// Alloc: where the character arrays come from, see Allocator.hpp
+template< typename C, typename Alloc = DefaultAllocator >
 struct StringT
 {
   private:
@@ -80,6 +84,23 @@ struct StringT
         return detail::strtools< C >::strlen( x );
     }
 
+    // room for len characters and the terminator
+    static C* alloc_str( const size_t len )
+    {
+        C* const x = ( C* ) Alloc::alloc( ( len + 1 ) * sizeof( C ), alignof( C ) );
+        assert( x );
+        return x;
+    }
+
+    static void dealloc_str( C* const x )
+    {
+        if constexpr ( Alloc::sized_dealloc ) {
+            Alloc::dealloc( ( void* ) x, ( strlen( x ) + 1 ) * sizeof( C ) );
+        } else {
+            Alloc::dealloc( ( void* ) x, 0 );
+        }
+    }
+
     constexpr static const C emptystr {};
   public:
     C* str; // NULL-terminated underlying string
@@ -92,7 +113,7 @@ struct StringT
         : str( nullptr )
     {
         size_t len = strlen( x );
-        str = ( C* ) calloc( len + 1, sizeof( C ) );
+        str = alloc_str( len );
         detail::strtools< C >::strncpy( str, x, len );
         new( str + len ) C( emptystr );
     }
@@ -101,13 +122,15 @@ struct StringT
         : StringT( ( const C* const ) x )
     {}
 
-    StringT( const StringT< C >& x )
+    StringT( const StringT< C, Alloc >& x )
         : StringT( ( const C* const ) x.str )
     {}
 
     ~StringT()
     {
-        free( ( void* ) str );
+        if ( str ) {
+            dealloc_str( str );
+        }
         str = nullptr;
     }
 
@@ -127,47 +150,45 @@ struct StringT
         return c_str();
     }
 
-    StringT< C >& operator=( const StringT< C >& x )
+    StringT< C, Alloc >& operator=( const StringT< C, Alloc >& x )
     {
-        this -> ~StringT< C >();
-        new( this ) StringT< C >( x );
+        this -> ~StringT();
+        new( this ) StringT< C, Alloc >( x );
         return *this;
     }
 
-    StringT< C >& operator=( const C* const x )
+    StringT< C, Alloc >& operator=( const C* const x )
     {
-        this -> ~StringT< C >();
-        new( this ) StringT< C >( x );
+        this -> ~StringT();
+        new( this ) StringT< C, Alloc >( x );
         return *this;
     }
 
-    StringT< C >& operator=( C* const x )
+    StringT< C, Alloc >& operator=( C* const x )
     {
         return ( *this = ( const C* const ) x );
     }
 
-    StringT< C >& operator+=( const StringT< C >& x )
+    StringT< C, Alloc >& operator+=( const StringT< C, Alloc >& x )
     {
         *this = *this + x;
         return *this;
     }
 
-    StringT< C > operator+( const StringT< C >& x ) const
+    StringT< C, Alloc > operator+( const StringT< C, Alloc >& x ) const
     {
         const size_t len = length();
         const size_t xlen = x.length();
-        C* nstr = ( C* ) calloc( alignof( C )
-                               , ( len + xlen + 1 ) * sizeof( C )
-                               );
+        C* nstr = alloc_str( len + xlen );
         memcpy( nstr, str, len * sizeof( C ) );
-        memcpy( nstr + len, x.str, xlen );
+        memcpy( nstr + len, x.str, xlen * sizeof( C ) );
         memset( nstr + len + xlen, 0, sizeof( C ) );
-        StringT< C > y( nstr );
-        free( nstr );
+        StringT< C, Alloc > y( nstr );
+        dealloc_str( nstr );
         return y;
     }
 
-    bool operator==( const StringT< C >& x ) const
+    bool operator==( const StringT< C, Alloc >& x ) const
     {
         size_t xlen = x.length();
         size_t ownlength = length();
@@ -175,16 +196,16 @@ struct StringT
             return false;
         }
 
-        return 0 == memcmp( c_str(), x.c_str(), ownlength );
+        return 0 == memcmp( c_str(), x.c_str(), ownlength * sizeof( C ) );
     }
 
-    bool operator!=( const StringT< C >& x ) const
+    bool operator!=( const StringT< C, Alloc >& x ) const
     {
         return ! ( *this ==  x );
     }
 
     // will return less if asking for something past end and nothing if asking for start > end and start > length
-    StringT< C > take( size_t start, size_t end ) const
+    StringT< C, Alloc > take( size_t start, size_t end ) const
     {
         if ( end <= length() ) {
             // alright
@@ -200,7 +221,7 @@ struct StringT
         memset( &tmp, 0, ( end - start + 1 ) * sizeof( C ) );
         memcpy( &tmp, str + start, end - start );
 
-        StringT< C > toreturn( tmp );
+        StringT< C, Alloc > toreturn( tmp );
         return toreturn;
     }
 };
@@ -208,12 +229,78 @@ struct StringT
 typedef StringT< char > String;
 typedef StringT< char32_t > UTF32LEString;
 
+// only holds a pointer to it's heap allocated array
+template< typename C, typename Alloc >
+struct is_trivially_relocatable< StringT< C, Alloc > >
+    : std::true_type
+{};
+
+// maps keyed by StringT< C, Alloc > may be searched with a null terminated C*, a std::basic_string_view< C > or a ( pointer, length ) pair
+// hashes have to match std::hash< StringT< C, Alloc > > below
+template< typename C, typename Alloc >
+struct lookup_key< StringT< C, Alloc >, std::pair< const C*, size_t > >
+{
+    static const bool value = true;
+
+    static size_t hash( const std::pair< const C*, size_t >& q )
+    {
+        return std::_Hash_impl::hash( q.first, q.second );
+    }
+
+    static bool eq( const StringT< C, Alloc >* const k, const std::pair< const C*, size_t >& q )
+    {
+        return k -> length() == q.second
+            && 0 == memcmp( k -> c_str(), q.first, q.second * sizeof( C ) );
+    }
+};
+
+template< typename C, typename Alloc >
+struct lookup_key< StringT< C, Alloc >, std::basic_string_view< C > >
+{
+    typedef lookup_key< StringT< C, Alloc >, std::pair< const C*, size_t > > pair_lookup;
+
+    static const bool value = true;
+
+    static size_t hash( const std::basic_string_view< C >& q )
+    {
+        return pair_lookup::hash( std::make_pair( q.data(), q.size() ) );
+    }
+
+    static bool eq( const StringT< C, Alloc >* const k, const std::basic_string_view< C >& q )
+    {
+        return pair_lookup::eq( k, std::make_pair( q.data(), q.size() ) );
+    }
+};
+
+template< typename C, typename Alloc >
+struct lookup_key< StringT< C, Alloc >, const C* >
+{
+    typedef lookup_key< StringT< C, Alloc >, std::pair< const C*, size_t > > pair_lookup;
+
+    static const bool value = true;
+
+    static size_t hash( const C* const q )
+    {
+        return pair_lookup::hash( std::make_pair( q, detail::strtools< C >::strlen( q ) ) );
+    }
+
+    static bool eq( const StringT< C, Alloc >* const k, const C* const q )
+    {
+        return pair_lookup::eq( k, std::make_pair( q, detail::strtools< C >::strlen( q ) ) );
+    }
+};
+
+template< typename C, typename Alloc >
+struct lookup_key< StringT< C, Alloc >, C* >
+    : lookup_key< StringT< C, Alloc >, const C* >
+{};
+
 }
 
-template< typename C >
-struct std::hash< LibSio::StringT< C > >
+template< typename C, typename Alloc >
+struct std::hash< LibSio::StringT< C, Alloc > >
 {
-    size_t operator()( const LibSio::StringT< C >& x ) const
+    size_t operator()( const LibSio::StringT< C, Alloc >& x ) const
     {
         return std::_Hash_impl::hash( x.c_str(), x.length() );
     }
@@ -0,0 +1,541 @@
+/*
+  Open addressing hashmap probing groups of control bytes, in the style of Swiss tables.
+  Copyright (C) 2018 Sio Kreuzer
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// An alternative to HashMap for keys that have no value to spare as the empty key, or are too large for HashMap's two cacheline windows:
+// -> the table is split into groups of ctrl_group_width slots (16, 32 with AVX2), each with it's control bytes (see ControlBytes.hpp)
+// -> a key starts probing at group Index::index( mixed hash, group count ) and continues quadratically over groups (1, 2, 3, ... groups further each step; visits every group, as the group count is a power of two)
+//    -> each group is searched in one go: keys are only compared on 7 bit hash fragment hits
+//    -> a probe stops at the first group with an empty slot in it
+// -> removing a key marks it's slot ctrl_deleted (a tombstone) if it's group is full, so probes passing through that group go on. If the group has an empty slot, no probe ever passed through it, so the slot becomes empty instead.
+// -> the table grows (or, if tombstones make up for much of the load, is rebuilt at the same size) once full slots and tombstones exceed max_load_percent of it
+// -> emptiness is kept in the control bytes only: no empty key, and free slots hold no objects
+// Keys and values have no size restrictions, keys are moved (or memcpy'd if is_trivially_relocatable) when the table is rebuilt.
+// Performance characteristics:
+//   -> get/rm: O(1) expected, a few groups at most at max_load_percent
+//   -> insert: O(1) amortized, O(n) when the table is rebuilt
+#pragma once
+
+#include <cassert>
+#include <cstring>
+#include <utility>
+#include <type_traits>
+
+#include "StaticHashMap.hpp"
+#include "ControlBytes.hpp"
+#include "IndexPolicy.hpp"
+#include "Allocator.hpp"
+#include "Optional.hpp"
+
+#include "utils.hpp"
+
+namespace LibSio
+{
+
+template< typename K, typename V
+        , size_t ( *_hash )( const K* const x ) = standard_hash< K >
+        , bool ( *eq )( const K* const a, const K* const b ) = standard_eq< K >
+        , typename Index = MaskIndex<> // group counts are powers of two, so any policy works
+        , typename Alloc = DefaultAllocator >
+struct SwissHashMap
+{
+    typedef SwissHashMap< K, V, _hash, eq, Index, Alloc > own_type;
+
+    constexpr static const size_t no_index = __SIZE_MAX__;
+    static const size_t group_width = detail::ctrl_group_width;
+    static const size_t max_load_percent = 87; // full slots and tombstones, ~7/8
+    static const size_t get_many_batch = 16; // keys hashed and prefetched ahead of resolving them in get_many()
+
+    // layout: control bytes, keys, values (each aligned for it's type)
+    byte* table;
+    size_t length; // slots, a multiple of group_width
+    size_t elements;
+    size_t tombstones;
+
+    static inline size_t keys_offset( const size_t length )
+    {
+        return ( length + alignof( K ) - 1 ) & ~( alignof( K ) - 1 );
+    }
+
+    static inline size_t values_offset( const size_t length )
+    {
+        return ( keys_offset( length ) + length * sizeof( K ) + alignof( V ) - 1 ) & ~( alignof( V ) - 1 );
+    }
+
+    static inline size_t table_len_in_bytes( const size_t length )
+    {
+        return values_offset( length ) + length * sizeof( V );
+    }
+
+    inline u8* ctrl()
+    {
+        return ( u8* ) table;
+    }
+
+    inline K* keys()
+    {
+        return ( K* ) ( table + keys_offset( length ) );
+    }
+
+    inline V* values()
+    {
+        return ( V* ) ( table + values_offset( length ) );
+    }
+
+    inline size_t groups()
+    {
+        return length / group_width;
+    }
+
+    inline bool is_full( const size_t i )
+    {
+        return detail::ctrl_is_full( ctrl()[i] );
+    }
+
+    static inline size_t hash_full( const K* const k )
+    {
+        return Index::mix( _hash( k ) );
+    }
+
+    static inline size_t max_load( const size_t length )
+    {
+        return length * max_load_percent / 100;
+    }
+
+    inline void alloc_table()
+    {
+        table = ( byte* ) Alloc::alloc( table_len_in_bytes( length ), 64 );
+        assert( table );
+        memset( ctrl(), detail::ctrl_empty, length );
+    }
+
+    inline void destroy_table()
+    {
+        if ( !table ) {
+            return;
+        }
+        for ( size_t i = 0; i < length; i++ ) {
+            if ( is_full( i ) ) {
+                callDestructorIfExistent< K >( keys() + i );
+                callDestructorIfExistent< V >( values() + i );
+            }
+        }
+        Alloc::dealloc( table, table_len_in_bytes( length ) );
+        table = nullptr;
+    }
+
+    // index of the slot with a key that matches( key ) is true for, no_index if there is none
+    template< typename M >
+    size_t find( const size_t hashed, M matches )
+    {
+        const u8 tag = detail::ctrl_tag( hashed );
+        const size_t mask = groups() - 1;
+        size_t g = Index::index( hashed, groups() );
+        for ( size_t step = 1; step <= groups(); step++ ) {
+            const size_t base = g * group_width;
+            const detail::CtrlGroup group( ctrl() + base );
+            for ( u32 m = group.match( tag ); m; m &= m - 1 ) {
+                const size_t i = base + __builtin_ctz( m );
+                if ( matches( keys() + i ) ) {
+                    return i;
+                }
+            }
+            if ( group.match( detail::ctrl_empty ) ) {
+                return no_index;
+            }
+            g = ( g + step ) & mask;
+        }
+        return no_index;
+    }
+
+    // first empty or deleted slot on the probe sequence of hashed (there always is one, the table is never full)
+    size_t find_free( const size_t hashed )
+    {
+        const size_t mask = groups() - 1;
+        size_t g = Index::index( hashed, groups() );
+        for ( size_t step = 1; ; step++ ) {
+            const size_t base = g * group_width;
+            const u32 m = detail::CtrlGroup( ctrl() + base ).match_empty();
+            if ( m ) {
+                return base + __builtin_ctz( m );
+            }
+            g = ( g + step ) & mask;
+        }
+    }
+
+    // rebuilds the table at length slots, dropping all tombstones
+    void resize_to( const size_t new_length )
+    {
+        own_type x( new_length, false );
+        for ( size_t i = 0; i < length; i++ ) {
+            if ( is_full( i ) ) {
+                const size_t hashed = hash_full( keys() + i );
+                const size_t n = x.find_free( hashed );
+                relocate< K >( x.keys() + n, keys() + i );
+                relocate< V >( x.values() + n, values() + i );
+                x.ctrl()[n] = detail::ctrl_tag( hashed );
+            }
+        }
+        Alloc::dealloc( table, table_len_in_bytes( length ) );
+        table = x.table;
+        length = x.length;
+        tombstones = 0;
+        x.table = nullptr;
+    }
+
+    // makes room for one more key
+    inline void grow_if_full()
+    {
+        if ( elements + tombstones + 1 <= max_load( length ) ) {
+            return;
+        }
+        if ( elements + 1 <= max_load( length ) / 2 ) {
+            resize_to( length ); // mostly tombstones, clearing them out is enough
+        } else {
+            resize_to( length * 2 );
+        }
+    }
+
+    static inline size_t length_for( const size_t n )
+    {
+        size_t l = group_width;
+        while ( max_load( l ) < n ) {
+            l *= 2;
+        }
+        return l;
+    }
+
+  private:
+    SwissHashMap( const size_t a_length, __attribute__((unused)) const bool sized )
+        : table( nullptr )
+        , length( a_length )
+        , elements( 0 )
+        , tombstones( 0 )
+    {
+        alloc_table();
+    }
+
+  public:
+    SwissHashMap()
+        : SwissHashMap( group_width, true )
+    {}
+
+    // bulk construction: sized for all count elements up front (if a key appears more than once, the first one wins)
+    SwissHashMap( const K* const keys, const V* const values, const size_t count )
+        : SwissHashMap( length_for( count ), true )
+    {
+        for ( size_t i = 0; i < count; i++ ) {
+            emplace( keys[i], values[i] );
+        }
+    }
+
+    // copies slot for slot, so nothing needs to be rehashed
+    SwissHashMap( SwissHashMap& x )
+        : SwissHashMap( x.length, true )
+    {
+        memcpy( ctrl(), x.ctrl(), length );
+        for ( size_t i = 0; i < length; i++ ) {
+            if ( is_full( i ) ) {
+                new( keys() + i ) K( x.keys()[i] );
+                new( values() + i ) V( x.values()[i] );
+            }
+        }
+        elements = x.elements;
+        tombstones = x.tombstones;
+    }
+
+    ~SwissHashMap()
+    {
+        destroy_table();
+    }
+
+    SwissHashMap& operator=( SwissHashMap& x )
+    {
+        this -> ~SwissHashMap();
+        new( this ) own_type( x );
+        return *this;
+    }
+
+    // makes sure the table is large enough for n elements in total without growing, only ever grows the table
+    void reserve( const size_t n )
+    {
+        const size_t l = length_for( n );
+        if ( l > length ) {
+            resize_to( l );
+        }
+    }
+
+    // get_ref for a key with mixed hash hashed that matches( key ) is true for
+    template< typename M >
+    V* get_ref_with( const size_t hashed, M matches )
+    {
+        const size_t i = find( hashed, matches );
+        return i != no_index ? values() + i : nullptr;
+    }
+
+    V* get_ref( const K& k )
+    {
+        return get_ref_with(
+            hash_full( &k )
+          , [&]
+            ( const K* const x )
+            -> bool
+            {
+                return eq( x, &k );
+            }
+        );
+    }
+
+    Optional< V > get( const K& k )
+    {
+        V* x = get_ref( k );
+        if ( x ) {
+            return Just< V >( *x );
+        } else {
+            return Nothing< V >();
+        }
+    }
+
+    // get_ref for n keys at once: out[i] = get_ref( ks[i] )
+    // hashes a batch of keys and prefetches their first groups before resolving any of them, so the cache misses overlap
+    void get_many( const K* const ks, const size_t n, V** const out )
+    {
+        size_t hashed[get_many_batch];
+        for ( size_t b = 0; b < n; b += get_many_batch ) {
+            const size_t batch = n - b < get_many_batch ? n - b : get_many_batch;
+            for ( size_t j = 0; j < batch; j++ ) {
+                hashed[j] = hash_full( ks + b + j );
+                const size_t base = Index::index( hashed[j], groups() ) * group_width;
+                __builtin_prefetch( ctrl() + base );
+                __builtin_prefetch( keys() + base );
+            }
+            for ( size_t j = 0; j < batch; j++ ) {
+                const K* const k = ks + b + j;
+                out[b + j] = get_ref_with(
+                    hashed[j]
+                  , [=]
+                    ( const K* const x )
+                    -> bool
+                    {
+                        return eq( x, k );
+                    }
+                );
+            }
+        }
+    }
+
+    // lookup_key< K, Q > for Q's the map may be searched by (see get_ref( const Q& ))
+    template< typename Q >
+    using lookup_for = typename std::enable_if< detail::heterogeneous_lookup< K, typename std::decay< Q >::type, _hash >::value
+                                              , detail::heterogeneous_lookup< K, typename std::decay< Q >::type, _hash >
+                                              >::type;
+
+    // get_ref/get/rm without constructing a K, e.g. by a const char* or std::string_view for String keys (see lookup_key in utils.hpp)
+    template< typename Q, typename L = lookup_for< Q > >
+    V* get_ref( const Q& q )
+    {
+        return get_ref_with(
+            Index::mix( L::hash( q ) )
+          , [&]
+            ( const K* const x )
+            -> bool
+            {
+                return L::eq( x, q );
+            }
+        );
+    }
+
+    template< typename Q, typename L = lookup_for< Q > >
+    Optional< V > get( const Q& q )
+    {
+        V* x = get_ref( q );
+        if ( x ) {
+            return Just< V >( *x );
+        } else {
+            return Nothing< V >();
+        }
+    }
+
+    template< typename Q, typename L = lookup_for< Q > >
+    void rm( const Q& q )
+    {
+        rm_with(
+            Index::mix( L::hash( q ) )
+          , [&]
+            ( const K* const x )
+            -> bool
+            {
+                return L::eq( x, q );
+            }
+        );
+    }
+
+    bool insert( const K& k, V& v )
+    {
+        return emplace( k, v );
+    }
+
+    // returns true on success, false if key already in map
+    template< typename... Args >
+    bool emplace( const K& k, Args... args )
+    {
+        return emplace_hashed( hash_full( &k ), k, args... );
+    }
+
+    // emplace with the mixed hash of k already computed
+    template< typename... Args >
+    bool emplace_hashed( const size_t hashed, const K& k, Args... args )
+    {
+        const size_t found = find(
+            hashed
+          , [&]
+            ( const K* const x )
+            -> bool
+            {
+                return eq( x, &k );
+            }
+        );
+        if ( found != no_index ) {
+            return false; // key already in map
+        }
+        grow_if_full();
+        const size_t n = find_free( hashed );
+        if ( ctrl()[n] == detail::ctrl_deleted ) {
+            tombstones--;
+        }
+        new( keys() + n ) K( k );
+        new( values() + n ) V( args... );
+        ctrl()[n] = detail::ctrl_tag( hashed );
+        elements++;
+        return true;
+    }
+
+    void rm( const K& k )
+    {
+        rm_with(
+            hash_full( &k )
+          , [&]
+            ( const K* const x )
+            -> bool
+            {
+                return eq( x, &k );
+            }
+        );
+    }
+
+    // rm for a key with mixed hash hashed that matches( key ) is true for
+    template< typename M >
+    void rm_with( const size_t hashed, M matches )
+    {
+        const size_t i = find( hashed, matches );
+        if ( i == no_index ) {
+            return;
+        }
+        callDestructorIfExistent< K >( keys() + i );
+        callDestructorIfExistent< V >( values() + i );
+        const size_t base = i - i % group_width;
+        if ( detail::CtrlGroup( ctrl() + base ).match( detail::ctrl_empty ) ) {
+            ctrl()[i] = detail::ctrl_empty;
+        } else {
+            ctrl()[i] = detail::ctrl_deleted;
+            tombstones++;
+        }
+        elements--;
+    }
+
+    void clear()
+    {
+        for ( size_t i = 0; i < length; i++ ) {
+            if ( is_full( i ) ) {
+                callDestructorIfExistent< K >( keys() + i );
+                callDestructorIfExistent< V >( values() + i );
+            }
+        }
+        memset( ctrl(), detail::ctrl_empty, length );
+        elements = 0;
+        tombstones = 0;
+    }
+
+    template< typename F >
+    inline void foreach_cell( F fn )
+    {
+        for ( size_t i = 0; i < length; i++ ) {
+            if ( is_full( i ) ) {
+                fn( ( const K* ) keys() + i, values() + i );
+            }
+        }
+    }
+
+    void foreach_value( void ( *fn )( V* value ) )
+    {
+        foreach_value_lambda( fn );
+    }
+
+    template< typename F >
+    void foreach_value_lambda( F fn )
+    {
+        foreach_cell(
+            [&]
+            ( __attribute__((unused)) const K* _, V* v )
+            -> void
+            {
+                fn( v );
+            }
+        );
+    }
+
+    void foreach( void ( *fn )( const K* key, V* value ) )
+    {
+        foreach_cell( fn );
+    }
+
+    template< typename F >
+    void foreach_lambda( F fn )
+    {
+        foreach_cell( fn );
+    }
+
+    // foreach/foreach_value for any callable (lambdas with captures, function objects), which unlike std::function can be inlined
+    template< typename F >
+    void foreach( F fn )
+    {
+        foreach_lambda( fn );
+    }
+
+    template< typename F >
+    void foreach_value( F fn )
+    {
+        foreach_value_lambda( fn );
+    }
+
+    // count of elements in container, O(1)
+    size_t count()
+    {
+        return elements;
+    }
+
+    bool empty()
+    {
+        return elements == 0;
+    }
+
+    size_t capacity()
+    {
+        return length;
+    }
+};
+
+}
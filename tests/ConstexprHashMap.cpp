@@ -0,0 +1,48 @@
+/*
+  Compile time checks of ConstexprHashMap.
+  Copyright (C) 2018 Sio Kreuzer
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Building and lookups of literal keys are folded by the compiler, so everything is checked by static_assert: this passes if it compiles.
+//
+// Build from the repository root, e.g.:
+//   g++ -std=gnu++17 -I. tests/ConstexprHashMap.cpp -o ConstexprHashMap && ./ConstexprHashMap
+// With -DCHECK_EMPTY_KEY (also together with -DNDEBUG), building must fail instead, as one of the entries is the empty key.
+
+#include "../ConstexprHashMap.hpp"
+
+using namespace LibSio;
+
+constexpr std::pair< const char*, int > entries[] = { { "one", 1 }, { "two", 2 }, { "three", 3 } };
+constexpr ConstexprHashMap< const char*, int, 8 > map( entries, nullptr );
+static_assert( map.get_or( "two", 0 ) == 2, "ConstexprHashMap: constexpr lookup" );
+static_assert( map.get_or( "four", 0 ) == 0, "ConstexprHashMap: constexpr lookup of a missing key" );
+static_assert( map.contains( "three" ) && !map.contains( nullptr ), "ConstexprHashMap: constexpr contains" );
+static_assert( map.count() == 3, "ConstexprHashMap: constexpr count" );
+
+constexpr std::pair< int, int > ints[] = { { 1, 10 }, { 9, 90 }, { 17, 170 }, { 1, 11 } };
+constexpr ConstexprHashMap< int, int, 4 > int_map( ints, 0 );
+static_assert( int_map.get_or( 17, 0 ) == 170 && int_map.get_or( 1, 0 ) == 10, "ConstexprHashMap: first of equal keys wins" );
+static_assert( int_map.count() == 3, "ConstexprHashMap: equal keys are only inserted once" );
+
+#ifdef CHECK_EMPTY_KEY
+constexpr std::pair< int, int > with_empty_key[] = { { 1, 10 }, { 0, 0 } };
+constexpr ConstexprHashMap< int, int, 4 > empty_key_map( with_empty_key, 0 );
+#endif
+
+int main()
+{
+    return 0;
+}
@@ -0,0 +1,213 @@
+/*
+  Randomized test of HashMap removal (backward shift deletion, rm_if) against std::unordered_map.
+  Copyright (C) 2018 Sio Kreuzer
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Random insert/rm/get/rm_if on a HashMap and a std::unordered_map side by side, for a number of Index policies, incremental_resize, store_hash, auto_shrink and both integer and String keys.
+// After every batch of operations, the HashMap has to hold exactly what the std::unordered_map holds.
+//
+// Build and run from the repository root, e.g.:
+//   g++ -std=gnu++17 -O1 -g -fsanitize=address,undefined -I. tests/HashMapRm.cpp -o HashMapRm && ./HashMapRm
+// Exits with 0 if everything matched, prints the first mismatch and exits with 1 otherwise.
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <random>
+#include <unordered_map>
+
+#include "../HashMap.hpp"
+#include "../String.hpp"
+
+using namespace LibSio;
+
+static const size_t rounds = 8;
+static const size_t ops_per_round = 20000;
+static const size_t ops_per_check = 1000;
+
+static void fail( const char* const name, const char* const what, const size_t op )
+{
+    printf( "%s: %s (after %zu operations)\n", name, what, op );
+    exit( 1 );
+}
+
+// integer keys, 0 is the empty key
+struct IntKeys
+{
+    typedef u64 key_type;
+    typedef u64 ref_key_type;
+
+    static u64 make( const u64 id )
+    {
+        return id + 1;
+    }
+
+    static u64 ref( const u64 id )
+    {
+        return id + 1;
+    }
+
+    static u64 empty()
+    {
+        return 0;
+    }
+};
+
+// String keys, the empty string is the empty key
+struct StringKeys
+{
+    typedef String key_type;
+    typedef std::string ref_key_type;
+
+    static String make( const u64 id )
+    {
+        return String( ref( id ).c_str() );
+    }
+
+    static std::string ref( const u64 id )
+    {
+        return "key" + std::to_string( id );
+    }
+
+    static String empty()
+    {
+        return String( "" );
+    }
+};
+
+// map and ref have to hold the same keys with the same values
+template< typename Map, typename Keys >
+static void check( const char* const name, Map& map, std::unordered_map< typename Keys::ref_key_type, u64 >& ref, const size_t op )
+{
+    if ( map.count() != ref.size() ) {
+        fail( name, "count() differs", op );
+    }
+    size_t n = 0;
+    map.foreach_lambda(
+        [&]
+        ( const typename Keys::key_type* k, u64* v )
+        -> void
+        {
+            n++;
+            const u64 id = *v >> 32;
+            auto it = ref.find( Keys::ref( id ) );
+            if ( it == ref.end() || it -> second != *v || !( *k == Keys::make( id ) ) ) {
+                fail( name, "foreach() visits an element that is not in the map", op );
+            }
+        }
+    );
+    if ( n != ref.size() ) {
+        fail( name, "foreach() visits the wrong number of elements", op );
+    }
+}
+
+// key_range: number of distinct keys, small enough that inserts hit present keys and removals hit present keys about half of the time
+template< typename Map, typename Keys >
+static void run( const char* const name, const u64 key_range )
+{
+    std::mt19937_64 rng( 1 );
+    for ( size_t round = 0; round < rounds; round++ ) {
+        Map map( Keys::empty() );
+        std::unordered_map< typename Keys::ref_key_type, u64 > ref;
+        u64 serial = 0;
+        for ( size_t op = 1; op <= ops_per_round; op++ ) {
+            const u64 id = rng() % key_range;
+            const u64 what = rng() % 16;
+            const auto k = Keys::make( id );
+            if ( what < 7 ) {
+                // value: id in the upper half (see check), a serial number in the lower one
+                const u64 v = ( id << 32 ) | ( serial++ & 0xFFFFFFFF );
+                const bool inserted = map.emplace( k, v );
+                if ( inserted != ( ref.find( Keys::ref( id ) ) == ref.end() ) ) {
+                    fail( name, "emplace() disagrees on whether the key was in the map", op );
+                }
+                if ( inserted ) {
+                    ref[Keys::ref( id )] = v;
+                }
+            } else if ( what < 13 ) {
+                map.rm( k );
+                ref.erase( Keys::ref( id ) );
+            } else if ( what < 15 ) {
+                u64* const v = map.get_ref( k );
+                auto it = ref.find( Keys::ref( id ) );
+                if ( ( v == nullptr ) != ( it == ref.end() ) || ( v && *v != it -> second ) ) {
+                    fail( name, "get_ref() differs", op );
+                }
+            } else if ( rng() % 64 == 0 ) {
+                // removes roughly a third of the elements, shifting runs of neighbours back into the holes
+                const u64 m = rng() % 3;
+                map.rm_if(
+                    [&]
+                    ( __attribute__((unused)) const typename Keys::key_type* _k, u64* v )
+                    -> bool
+                    {
+                        return ( *v >> 32 ) % 3 == m;
+                    }
+                );
+                for ( auto it = ref.begin(); it != ref.end(); ) {
+                    if ( ( it -> second >> 32 ) % 3 == m ) {
+                        it = ref.erase( it );
+                    } else {
+                        ++it;
+                    }
+                }
+            }
+            if ( op % ops_per_check == 0 ) {
+                check< Map, Keys >( name, map, ref, op );
+            }
+        }
+        // everything that is left has to be found again, then removed one by one
+        for ( u64 id = 0; id < key_range; id++ ) {
+            u64* const v = map.get_ref( Keys::make( id ) );
+            auto it = ref.find( Keys::ref( id ) );
+            if ( ( v == nullptr ) != ( it == ref.end() ) || ( v && *v != it -> second ) ) {
+                fail( name, "get_ref() differs after the last operation", ops_per_round );
+            }
+            map.rm( Keys::make( id ) );
+        }
+        if ( map.count() != 0 ) {
+            fail( name, "elements left after removing all keys", ops_per_round );
+        }
+    }
+    printf( "%s: ok\n", name );
+}
+
+template< typename Keys
+        , typename Index = MaskIndex<>
+        , bool incremental_resize = false
+        , bool store_hash = false
+        , bool auto_shrink = false >
+using TestMap = HashMap< typename Keys::key_type, u64
+                       , standard_hash< typename Keys::key_type >
+                       , standard_eq< typename Keys::key_type >
+                       , Index, incremental_resize, store_hash, auto_shrink >;
+
+int main()
+{
+    run< TestMap< IntKeys >, IntKeys >( "u64", 4096 );
+    run< TestMap< IntKeys, ModuloIndex<> >, IntKeys >( "u64, ModuloIndex", 4096 );
+    run< TestMap< IntKeys, ShiftIndex<> >, IntKeys >( "u64, ShiftIndex", 4096 );
+    run< TestMap< IntKeys, FastRangeIndex<> >, IntKeys >( "u64, FastRangeIndex", 4096 );
+    // consecutive keys land in consecutive slots: long runs for the shift to move
+    run< TestMap< IntKeys, MaskIndex< IdentityMix > >, IntKeys >( "u64, MaskIndex< IdentityMix >", 4096 );
+    run< TestMap< IntKeys, MaskIndex<>, true >, IntKeys >( "u64, incremental_resize", 4096 );
+    run< TestMap< IntKeys, MaskIndex<>, false, true >, IntKeys >( "u64, store_hash", 4096 );
+    run< TestMap< IntKeys, MaskIndex<>, false, false, true >, IntKeys >( "u64, auto_shrink", 4096 );
+    run< TestMap< IntKeys, MaskIndex<>, true, true, true >, IntKeys >( "u64, incremental_resize, store_hash, auto_shrink", 4096 );
+    run< TestMap< StringKeys >, StringKeys >( "String", 2048 );
+    run< TestMap< StringKeys, MaskIndex<>, false, true >, StringKeys >( "String, store_hash", 2048 );
+    run< TestMap< StringKeys, MaskIndex<>, true, true, true >, StringKeys >( "String, incremental_resize, store_hash, auto_shrink", 2048 );
+    return 0;
+}
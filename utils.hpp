@@ -18,6 +18,10 @@
 #pragma once
 
 #include <stdint.h>
+#include <cstring>
+
+#include <type_traits>
+#include <utility>
 
 namespace LibSio
 {
@@ -46,6 +50,38 @@ void callDestructorIfExistent( ... )
     // do nothing
 }
 
+// whether a T may be moved to a different address by copying its bytes (after which the original is simply forgotten, no destructor is called on it)
+// true for trivially copyable types; specialize for types that aren't trivially copyable but still don't care about their own address (e.g. types owning a heap allocation)
+template< typename T >
+struct is_trivially_relocatable
+    : std::is_trivially_copyable< T >
+{};
+
+// move the object at src to dst (which must not contain an object), leaving no object at src
+template< typename T >
+void relocate( T* const dst, T* const src )
+{
+    if constexpr ( std::is_empty< T >::value && is_trivially_relocatable< T >::value ) {
+        // nothing to move (and src may well be dst, see KeysOnlyLayout in Layout.hpp)
+    } else if constexpr ( is_trivially_relocatable< T >::value ) {
+        memcpy( ( void* ) dst, ( const void* ) src, sizeof( T ) );
+    } else {
+        new( dst ) T( std::move( *src ) );
+        callDestructorIfExistent< T >( src );
+    }
+}
+
+// lets maps keyed by K be searched using a Q, without having to construct a K from it.
+// Specializations set value to true and provide:
+//   static size_t hash( const Q& q ) -> must be equal to standard_hash< K > of the K constructed from q
+//   static bool eq( const K* const k, const Q& q )
+// Only used by maps using standard_hash< K > as their hash function, as the hashes would not match up otherwise.
+template< typename K, typename Q >
+struct lookup_key
+{
+    static const bool value = false;
+};
+
 // forcibly reinterpret some bits
 template< typename dst, typename src >
 dst reinterpret( src x )